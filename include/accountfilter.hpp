@@ -0,0 +1,152 @@
+#ifndef ACCOUNTFILTER_HPP
+#define ACCOUNTFILTER_HPP
+
+#include "published.hpp"
+
+#include <protocol/messages.capnp.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A Bloom filter of the IDs and names of all GitLab users and groups. The daemon builds it and publishes it in a
+ * file next to the client settings, such that the NSS module can answer lookups of IDs and names that certainly do not
+ * belong to GitLab (e.g., subuids of containers or orphaned files) without asking the daemon.
+ *
+ * The filter never rejects a known account. Accounts created after the filter was built are covered since GitLab's IDs
+ * only grow: IDs above the highest known ID are never rejected. Names are only rejected if the daemon vouches for the
+ * names being complete (see names).
+ */
+struct AccountFilter {
+	static constexpr const char Path[] = "/var/run/gitlabnss.filter";
+
+	enum class Kind : uint8_t { UserID, UserName, GroupID, GroupName };
+
+	uint64_t generation = 0;
+	unsigned hashes = 1;
+	std::vector<uint64_t> bits;
+	uint32_t maxUserID = 0;
+	uint32_t maxGroupID = 0;
+	bool names = false;
+
+	/**
+	 * @brief Creates an empty filter sized for the given number of keys at a false positive rate of about 1%.
+	 */
+	static AccountFilter withCapacity(size_t keys) {
+		AccountFilter ret;
+		// ~9.6 bits per key and 7 hash functions are optimal for 1%
+		ret.bits.resize((std::max<size_t>(keys, 64) * 10 + 63) / 64);
+		ret.hashes = 7;
+		return ret;
+	}
+
+	/**
+	 * @returns true if the filter changed, i.e., if it did not contain the key already.
+	 */
+	bool add(Kind kind, uint32_t id) {
+		if (bits.empty())
+			return false;
+		bool changed = insert(hash(kind, id));
+		uint32_t& maxID = (kind == Kind::UserID) ? maxUserID : maxGroupID;
+		if (id > maxID) {
+			maxID = id;
+			changed = true;
+		}
+		return changed;
+	}
+	bool add(Kind kind, std::string_view name) { return !bits.empty() && insert(hash(kind, name)); }
+
+	bool mayContain(Kind kind, uint32_t id) const {
+		uint32_t maxID = (kind == Kind::UserID) ? maxUserID : maxGroupID;
+		return bits.empty() || id > maxID || contains(hash(kind, id));
+	}
+	bool mayContain(Kind kind, std::string_view name) const {
+		return bits.empty() || !names || contains(hash(kind, name));
+	}
+
+	/**
+	 * @brief Reads the published filter. Returns std::nullopt if there is none (or it can't be read), in which case
+	 * nothing may be rejected.
+	 */
+	static std::optional<AccountFilter> read() noexcept {
+		capnp::ReaderOptions options;
+		options.traversalLimitInWords = 64 * 1024 * 1024;
+		auto parse = [](AccountFilterData::Reader data) -> std::optional<AccountFilter> {
+			AccountFilter filter{
+					.generation = data.getGeneration(),
+					.hashes = data.getHashes(),
+					.maxUserID = data.getMaxUserID(),
+					.maxGroupID = data.getMaxGroupID(),
+					.names = data.getNames()
+			};
+			filter.bits.assign(data.getBits().begin(), data.getBits().end());
+			if (filter.hashes == 0)
+				return std::nullopt;
+			return filter;
+		};
+		return readPublished<AccountFilter, AccountFilterData>(Path, parse, options);
+	}
+
+	bool write() const noexcept {
+		return publishMessage<AccountFilterData>(Path, [this](AccountFilterData::Builder data) {
+			data.setGeneration(generation);
+			data.setHashes(hashes);
+			auto output = data.initBits(bits.size());
+			for (size_t i = 0; i < bits.size(); ++i)
+				output.set(i, bits[i]);
+			data.setMaxUserID(maxUserID);
+			data.setMaxGroupID(maxGroupID);
+			data.setNames(names);
+		});
+	}
+
+private:
+	/** FNV-1a; unlike std::hash, it is guaranteed to be the same in the daemon and in every client **/
+	static uint64_t hash(Kind kind, const void* data, size_t size) noexcept {
+		uint64_t ret = 0xcbf29ce484222325ull;
+		auto mix = [&ret](uint8_t byte) { ret = (ret ^ byte) * 0x100000001b3ull; };
+		mix(static_cast<uint8_t>(kind));
+		for (size_t i = 0; i < size; ++i)
+			mix(static_cast<const uint8_t*>(data)[i]);
+		return ret;
+	}
+	static uint64_t hash(Kind kind, uint32_t id) noexcept {
+		const uint8_t bytes[] = {
+				static_cast<uint8_t>(id), static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id >> 16),
+				static_cast<uint8_t>(id >> 24)
+		};
+		return hash(kind, bytes, sizeof(bytes));
+	}
+	static uint64_t hash(Kind kind, std::string_view name) noexcept { return hash(kind, name.data(), name.size()); }
+
+	/** The i-th bit to set for a key is derived from two halves of its hash (double hashing) **/
+	size_t bitIndex(uint64_t hash, unsigned i) const noexcept {
+		uint64_t h1 = hash & 0xffffffffu;
+		uint64_t h2 = (hash >> 32) | 1;
+		return (h1 + i * h2) % (bits.size() * 64);
+	}
+	bool insert(uint64_t hash) {
+		bool changed = false;
+		for (unsigned i = 0; i < hashes; ++i) {
+			auto bit = bitIndex(hash, i);
+			auto mask = uint64_t{1} << (bit % 64);
+			changed |= (bits[bit / 64] & mask) == 0;
+			bits[bit / 64] |= mask;
+		}
+		return changed;
+	}
+	bool contains(uint64_t hash) const noexcept {
+		for (unsigned i = 0; i < hashes; ++i) {
+			auto bit = bitIndex(hash, i);
+			if ((bits[bit / 64] & (uint64_t{1} << (bit % 64))) == 0)
+				return false;
+		}
+		return true;
+	}
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,284 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Estimates the number of bytes an object occupies, including the heap memory it owns. Specialize it for types
+ * that own heap memory.
+ */
+template <typename T>
+struct Footprint {
+	static size_t of(const T&) noexcept { return sizeof(T); }
+};
+
+template <>
+struct Footprint<std::string> {
+	static size_t of(const std::string& value) noexcept {
+		// Short strings are stored inline (SSO); their capacity never exceeds the size of the object itself
+		return sizeof(std::string) + (value.capacity() >= sizeof(std::string) ? value.capacity() + 1 : 0);
+	}
+};
+
+template <typename T>
+struct Footprint<std::vector<T>> {
+	static size_t of(const std::vector<T>& value) noexcept {
+		return sizeof(std::vector<T>) + value.capacity() * sizeof(T);
+	}
+};
+
+/**
+ * @brief A count-min sketch of small counters that estimates how often a key was requested recently. All counters are
+ * halved periodically such that keys that were popular long ago are forgotten (see TinyLFU,
+ * https://arxiv.org/abs/1512.00727).
+ */
+class FrequencySketch final {
+private:
+	static constexpr unsigned Depth = 4;
+	static constexpr uint8_t MaxCount = 15;
+
+	std::vector<uint8_t> table;
+	size_t width;
+	size_t additions = 0;
+	size_t sampleSize;
+
+	static uint64_t mix(uint64_t x) noexcept {
+		// splitmix64 finalizer
+		x += 0x9e3779b97f4a7c15ull;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+	size_t index(uint64_t hash, unsigned row) const noexcept {
+		return row * width + (mix(hash + row * 0x9e3779b97f4a7c15ull) & (width - 1));
+	}
+
+public:
+	/**
+	 * @param agingFactor The counters are halved after this many times capacity lookups.
+	 */
+	explicit FrequencySketch(size_t capacity, unsigned agingFactor = 10)
+			: width(std::bit_ceil(std::max<size_t>(capacity, 16))),
+			  sampleSize(std::max(agingFactor, 1u) * std::max<size_t>(capacity, 16)) {
+		table.resize(Depth * width);
+	}
+
+	void increment(uint64_t hash) noexcept {
+		bool added = false;
+		for (unsigned row = 0; row < Depth; ++row) {
+			if (auto& counter = table[index(hash, row)]; counter < MaxCount) {
+				++counter;
+				added = true;
+			}
+		}
+		if (added && ++additions >= sampleSize) {
+			for (auto& counter : table)
+				counter >>= 1;
+			additions /= 2;
+		}
+	}
+
+	unsigned estimate(uint64_t hash) const noexcept {
+		unsigned ret = MaxCount;
+		for (unsigned row = 0; row < Depth; ++row)
+			ret = std::min<unsigned>(ret, table[index(hash, row)]);
+		return ret;
+	}
+};
+
+struct CacheOptions {
+	size_t maxEntries;
+	size_t maxBytes = 0;		 /**< The memory budget of the cache; 0 to only limit the number of entries. **/
+	std::chrono::seconds ttl{0}; /**< For how long an entry may be served; 0 to keep entries until they are evicted. **/
+	bool admission = true;		 /**< If a full cache only admits keys requested more often than its victim. **/
+	unsigned agingFactor = 10;	 /**< How quickly admission forgets old requests (see FrequencySketch). **/
+};
+
+struct CacheStats {
+	size_t entries;
+	size_t bytes;
+	size_t bytesPerEntry; /**< Average footprint of the cached entries, including their overhead. **/
+	size_t hits;
+	size_t misses;
+	size_t rejected; /**< Insertions refused by the admission policy or because the entry exceeds the budget. **/
+	size_t evicted;
+};
+
+/**
+ * @brief A cache of lookup results that is bounded by both, its number of entries and its memory footprint.
+ *
+ * Entries are evicted in least recently used order. With admission enabled, a full cache only makes room for a new
+ * key if that key was requested more often than the entry that would be evicted for it. Thus, a scan over many keys
+ * that are requested once (e.g., `find / -uid ...` or guessed usernames) does not evict the recurring lookups of real
+ * users.
+ *
+ * An entry may be found by a second key, its alias (e.g., a user by their ID and by their name), while its value is
+ * stored only once.
+ */
+template <typename K, typename V, typename Clock = std::chrono::steady_clock>
+class LookupCache final {
+private:
+	/** Rough per entry overhead of the list node and the index **/
+	static constexpr size_t EntryOverhead = 8 * sizeof(void*);
+
+	struct Entry {
+		K key;
+		std::optional<K> alias;
+		V value;
+		size_t bytes;
+		typename Clock::time_point inserted;
+	};
+	using Iterator = typename std::list<Entry>::iterator;
+
+	CacheOptions options;
+	std::list<Entry> entries; /**< The most recently used entry first. **/
+	std::unordered_map<K, Iterator> index;
+	FrequencySketch sketch;
+	size_t bytes = 0;
+	size_t hits = 0;
+	size_t misses = 0;
+	size_t rejected = 0;
+	size_t evicted = 0;
+
+	static uint64_t hash(const K& key) { return std::hash<K>{}(key); }
+
+	bool isExpired(const Entry& entry, typename Clock::time_point now) const {
+		return options.ttl.count() > 0 && now - entry.inserted >= options.ttl;
+	}
+	bool isFull(size_t additionalBytes) const {
+		return entries.size() >= options.maxEntries ||
+			   (options.maxBytes > 0 && bytes + additionalBytes > options.maxBytes);
+	}
+	void remove(Iterator it) {
+		bytes -= it->bytes;
+		index.erase(it->key);
+		if (it->alias)
+			index.erase(*it->alias);
+		entries.erase(it);
+	}
+	void remove(const K& key) {
+		if (auto it = index.find(key); it != index.end())
+			remove(it->second);
+	}
+	/** An entry is requested as often as it is requested by either of its keys **/
+	unsigned frequency(const K& key, const std::optional<K>& alias) const {
+		auto ret = sketch.estimate(hash(key));
+		return alias ? std::max(ret, sketch.estimate(hash(*alias))) : ret;
+	}
+
+	bool insert(const K& key, std::optional<K> alias, const V& value) {
+		auto now = Clock::now();
+		size_t size = Footprint<K>::of(key) + (alias ? Footprint<K>::of(*alias) : 0) + Footprint<V>::of(value) +
+					  EntryOverhead;
+		remove(key);
+		if (alias)
+			remove(*alias);
+		if (options.maxEntries == 0 || (options.maxBytes > 0 && size > options.maxBytes)) {
+			++rejected;
+			return false;
+		}
+		auto requested = frequency(key, alias);
+		while (isFull(size)) {
+			const auto& victim = entries.back();
+			if (options.admission && !isExpired(victim, now) && requested <= frequency(victim.key, victim.alias)) {
+				++rejected;
+				return false;
+			}
+			remove(std::prev(entries.end()));
+			++evicted;
+		}
+		entries.push_front(
+				Entry{.key = key, .alias = std::move(alias), .value = value, .bytes = size, .inserted = now}
+		);
+		index.emplace(key, entries.begin());
+		if (entries.front().alias)
+			index.emplace(*entries.front().alias, entries.begin());
+		bytes += size;
+		return true;
+	}
+
+public:
+	explicit LookupCache(const CacheOptions& options)
+			: options(options), sketch(options.maxEntries, options.agingFactor) {}
+
+	/**
+	 * @brief Returns the cached value or nullptr on a cachemiss. The pointer is only valid until the cache is modified.
+	 */
+	const V* find(const K& key) {
+		sketch.increment(hash(key));
+		auto it = index.find(key);
+		if (it == index.end()) {
+			++misses;
+			return nullptr;
+		}
+		if (isExpired(*it->second, Clock::now())) {
+			remove(it->second);
+			++misses;
+			return nullptr;
+		}
+		entries.splice(entries.begin(), entries, it->second);
+		++hits;
+		return &it->second->value;
+	}
+
+	/**
+	 * @returns false if the value was not admitted to the cache.
+	 */
+	bool insert_or_assign(const K& key, const V& value) { return insert(key, std::nullopt, value); }
+	/**
+	 * @brief Caches the value under both keys. Entries previously found by either key are replaced.
+	 * @returns false if the value was not admitted to the cache.
+	 */
+	bool insert_or_assign(const K& key, const K& alias, const V& value) { return insert(key, alias, value); }
+
+	/**
+	 * @brief Checks if the key is cached without counting it as a lookup.
+	 */
+	bool contains(const K& key) const { return peek(key) != nullptr; }
+
+	/**
+	 * @brief Like find, but does not count as a lookup: neither the statistics, the admission policy nor the order of
+	 * eviction are affected.
+	 */
+	const V* peek(const K& key) const {
+		auto it = index.find(key);
+		if (it == index.end() || isExpired(*it->second, Clock::now()))
+			return nullptr;
+		return &it->second->value;
+	}
+
+	/**
+	 * @brief Removes the entry found by the key, i.e., also under its alias.
+	 */
+	void erase(const K& key) { remove(key); }
+	void clear() {
+		index.clear();
+		entries.clear();
+		bytes = 0;
+	}
+
+	CacheStats stats() const {
+		return CacheStats{
+				.entries = entries.size(),
+				.bytes = bytes,
+				.bytesPerEntry = entries.empty() ? 0 : bytes / entries.size(),
+				.hits = hits,
+				.misses = misses,
+				.rejected = rejected,
+				.evicted = evicted
+		};
+	}
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef CLIENTCONFIG_HPP
+#define CLIENTCONFIG_HPP
+
+#include "published.hpp"
+
+#include <protocol/messages.capnp.h>
+
+#include <chrono>
+#include <optional>
+
+/**
+ * @brief The few settings that the NSS module needs itself. The daemon publishes them in a small binary file on
+ * startup, such that loading libnss_gitlab never has to parse gitlabnss.conf (or read the secret next to it).
+ */
+struct ClientConfig {
+	static constexpr const char Path[] = "/var/run/gitlabnss.client";
+	/** The timeout to use if the daemon has not published its settings (yet) **/
+	static constexpr std::chrono::milliseconds DefaultTimeout{5000};
+
+	unsigned uidOffset;
+	unsigned gidOffset;
+	std::chrono::milliseconds timeout;
+	unsigned breakerThreshold;
+	std::chrono::seconds breakerCooldown;
+
+	/** std::nullopt if the daemon has not published its settings (yet) **/
+	static std::optional<ClientConfig> read() noexcept {
+		return readPublished<ClientConfig, ClientSettings>(Path, [](ClientSettings::Reader settings) {
+			return ClientConfig{
+					.uidOffset = settings.getUidOffset(),
+					.gidOffset = settings.getGidOffset(),
+					.timeout = std::chrono::milliseconds{settings.getTimeout()},
+					.breakerThreshold = settings.getBreakerThreshold(),
+					.breakerCooldown = std::chrono::seconds{settings.getBreakerCooldown()}
+			};
+		});
+	}
+
+	bool write() const noexcept {
+		return publishMessage<ClientSettings>(Path, [this](ClientSettings::Builder settings) {
+			settings.setUidOffset(uidOffset);
+			settings.setGidOffset(gidOffset);
+			settings.setTimeout(static_cast<uint32_t>(timeout.count()));
+			settings.setBreakerThreshold(breakerThreshold);
+			settings.setBreakerCooldown(static_cast<uint32_t>(breakerCooldown.count()));
+		});
+	}
+};
+
+#endif
\ No newline at end of file
@@ -5,14 +5,23 @@
 #include <map>
 #include <optional>
 #include <string>
+#include <vector>
 
 struct Config {
 	// general settings
 	static constexpr const char DefaultSocketPath[] = "/var/run/gitlabnss.sock";
 	static constexpr uint16_t DefaultSocketPerms = 0666u;
 	static constexpr const char DefaultSocketOwner[] = "root:root";
+	static constexpr unsigned DefaultStatsInterval = 600;
+	static constexpr unsigned DefaultSlowThreshold = 1000;
+	static constexpr const char DefaultSlowLog[] = "/var/log/gitlabnss-slow.log";
+	static constexpr const char DefaultRecordFile[] = "";
 	// gitlabapi settings
-	// (no defaults)
+	static constexpr unsigned DefaultAPITimeout = 3000;
+	// client settings
+	static constexpr unsigned DefaultClientTimeout = 5000;
+	static constexpr unsigned DefaultBreakerThreshold = 3;
+	static constexpr unsigned DefaultBreakerCooldown = 30;
 	// nss settings
 	static constexpr uint16_t DefaultHomePerms = 0700u;
 	static constexpr unsigned DefaultUIDOffset = 0;
@@ -21,16 +30,44 @@ struct Config {
 	static constexpr const char DefaultGroupPrefix[] = "";
 	static constexpr unsigned DefaultUserCachesize = 500;
 	static constexpr unsigned DefaultGroupCachesize = 200;
+	static constexpr size_t DefaultUserCacheBytes = 4 * 1024 * 1024;
+	static constexpr size_t DefaultGroupCacheBytes = 1024 * 1024;
+	static constexpr unsigned DefaultCacheTTL = 60 * 60;
+	static constexpr bool DefaultCacheAdmission = true;
+	static constexpr unsigned DefaultCacheAging = 10;
+	static constexpr unsigned DefaultKeysTTL = 0;
+	static constexpr bool DefaultPrefetch = true;
+	// limits settings
+	static constexpr unsigned DefaultPerUIDRequests = 16;
+	static constexpr unsigned DefaultPerPIDRequests = 4;
+	static constexpr unsigned DefaultPerUIDRate = 50;
+	static constexpr unsigned DefaultPerUIDBurst = 100;
+	// systemhooks settings
+	// (no defaults; the listener is disabled unless an address is configured)
+	// filter settings
+	static constexpr unsigned DefaultFilterRefreshInterval = 60 * 60;
+	// warmup settings
+	static constexpr unsigned DefaultWarmupRefreshInterval = 0;
 
 	struct {
 		std::filesystem::path socketPath;
 		uint16_t socketPerms;
 		std::string socketOwner;
+		unsigned statsInterval;
+		unsigned slowThreshold;
+		std::filesystem::path slowLog;
+		std::filesystem::path recordFile;
 	} general;
 	struct {
 		std::string baseUrl;
 		std::string apikey;
+		unsigned timeout;
 	} gitlabapi;
+	struct {
+		unsigned timeout;
+		unsigned breakerThreshold;
+		unsigned breakerCooldown;
+	} client;
 	struct NSS {
 		std::filesystem::path homesRoot;
 		bool createHomedirs;
@@ -42,8 +79,34 @@ struct Config {
 		std::optional<std::string> primaryGroup;
 		unsigned userCachesize;
 		unsigned groupCachesize;
+		size_t userCacheBytes;
+		size_t groupCacheBytes;
+		unsigned cacheTTL;
+		bool cacheAdmission;
+		unsigned cacheAging;
 		std::map<std::string, std::string> groupMapping;
+		unsigned keysTTL;
+		bool prefetch;
 	} nss;
+	struct Limits {
+		unsigned perUIDRequests;
+		unsigned perPIDRequests;
+		unsigned perUIDRate;
+		unsigned perUIDBurst;
+	} limits;
+	struct {
+		std::string listen;
+		std::string secret;
+	} systemhooks;
+	struct {
+		bool enabled;
+		unsigned refreshInterval;
+		bool names;
+	} filter;
+	struct {
+		std::vector<std::string> groups;
+		unsigned refreshInterval;
+	} warmup;
 
 	static Config fromFile(const std::filesystem::path& file) noexcept;
 };
@@ -8,6 +8,8 @@ enum class Error {
 	ServerError,
 	ResponseFormatError,
 	GenericError,
+	Overloaded, /**< The daemon shed the request because the client exceeded its limits; retry later. **/
+	Timeout,	/**< GitLab did not respond in time. **/
 };
 
 #endif
\ No newline at end of file
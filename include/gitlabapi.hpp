@@ -4,6 +4,10 @@
 #include "config.hpp"
 #include "error.hpp"
 
+#include <chrono>
+#include <expected>
+#include <functional>
+#include <future>
 #include <string>
 #include <vector>
 
@@ -25,10 +29,26 @@ namespace gitlab {
 		std::vector<Group> groups;
 	};
 
+	/**
+	 * @brief Each lookup (e.g., fetchUserWithGroupsByUsername) has gitlabapi.timeout in total for all of its requests
+	 * to GitLab, such that the daemon answers within the time its clients wait for it.
+	 */
 	class GitLab final {
 	private:
+		using Deadline = std::chrono::steady_clock::time_point;
+
 		const Config& config;
 
+		/** The deadline of a lookup that starts now **/
+		Deadline newDeadline() const;
+		Error fetchUserByUsername(const std::string& username, User& user, Deadline deadline) const;
+		Error fetchUserByID(UserID id, User& user, Deadline deadline) const;
+		Error fetchAuthorizedKeys(UserID id, std::vector<std::string>& keys, Deadline deadline) const;
+		Error fetchGroups(User& user, Deadline deadline) const;
+		/** Fetches the keys into *keys on a thread of its own unless keys is null **/
+		std::future<void>
+		fetchKeysConcurrently(UserID id, std::expected<std::vector<std::string>, Error>* keys, Deadline deadline) const;
+
 	public:
 		explicit GitLab(const Config& config) noexcept;
 
@@ -40,6 +60,34 @@ namespace gitlab {
 
 		Error fetchGroupByName(const std::string& groupname, Group& group) const;
 		Error fetchGroupByID(GroupID id, Group& group) const;
+
+		/**
+		 * @brief Calls visit for every user resp. group known to GitLab, one page of results at a time, until visit
+		 * returns false. Only the groups and users that the API key may see are visited.
+		 */
+		Error forEachUser(const std::function<bool(const User&)>& visit) const;
+		Error forEachGroup(const std::function<bool(const Group&)>& visit) const;
+		/**
+		 * @brief Like forEachUser, but only visits the members of the group, including those inherited from parent
+		 * groups. The visited users have no groups.
+		 */
+		Error forEachMember(GroupID id, const std::function<bool(const User&)>& visit) const;
+
+		/**
+		 * @brief Fetches the user together with their groups. The requests that only need the user's ID are in flight
+		 * at the same time; that is, the user and their memberships (and optionally their keys) are requested at once.
+		 * @param keys If not null, also fetches the user's SSH keys and stores them (or the error fetching them) here.
+		 */
+		Error fetchUserWithGroupsByID(
+				UserID id, User& user, std::expected<std::vector<std::string>, Error>* keys = nullptr
+		) const;
+		/**
+		 * @brief Like fetchUserWithGroupsByID, but the user's ID must be looked up first. Only the requests after that
+		 * are in flight at the same time.
+		 */
+		Error fetchUserWithGroupsByUsername(
+				const std::string& username, User& user, std::expected<std::vector<std::string>, Error>* keys = nullptr
+		) const;
 	};
 } // namespace gitlab
 
@@ -0,0 +1,59 @@
+#ifndef INTERNER_HPP
+#define INTERNER_HPP
+
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief Stores each distinct string once in large, append-only blocks. The returned views stay valid for the lifetime
+ * of the interner and are null-terminated. Strings are never freed, which is fine for the small and slowly growing set
+ * of user and group names.
+ */
+class StringInterner final {
+private:
+	static constexpr size_t BlockSize = 64 * 1024;
+
+	std::vector<std::unique_ptr<char[]>> blocks;
+	char* current = nullptr; /**< The block that small strings are appended to. **/
+	size_t currentFree = 0;
+	size_t allocated = 0;
+	std::unordered_set<std::string_view> strings;
+
+	char* allocate(size_t size) {
+		if (size > BlockSize / 4) {
+			// Large strings get a dedicated block such that the current block is not abandoned
+			allocated += size;
+			return blocks.emplace_back(std::make_unique<char[]>(size)).get();
+		}
+		if (size > currentFree) {
+			current = blocks.emplace_back(std::make_unique<char[]>(BlockSize)).get();
+			currentFree = BlockSize;
+			allocated += BlockSize;
+		}
+		char* ptr = current + (BlockSize - currentFree);
+		currentFree -= size;
+		return ptr;
+	}
+
+public:
+	std::string_view intern(std::string_view str) {
+		if (auto it = strings.find(str); it != strings.end())
+			return *it;
+		char* ptr = allocate(str.size() + 1);
+		std::memcpy(ptr, str.data(), str.size());
+		ptr[str.size()] = '\0';
+		return *strings.emplace(ptr, str.size()).first;
+	}
+
+	size_t size() const noexcept { return strings.size(); }
+	/** The (approximate) number of bytes held by the interner including its index. **/
+	size_t bytes() const noexcept {
+		return allocated + strings.bucket_count() * sizeof(void*) +
+			   strings.size() * (sizeof(std::string_view) + 2 * sizeof(void*));
+	}
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,112 @@
+#ifndef PUBLISHED_HPP
+#define PUBLISHED_HPP
+
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+/**
+ * The daemon publishes what its clients need (see ClientConfig and AccountFilter) in small files that hold one Cap'n
+ * Proto message each. It replaces a file whenever it publishes a new version, such that a new version always comes with
+ * a new inode and clients never see a partially written file.
+ */
+
+/**
+ * @brief Builds a message with fill(root) and publishes it at path.
+ * @returns false if the file could not be written.
+ */
+template <typename Root, typename F>
+bool publishMessage(const char* path, F&& fill) noexcept {
+	std::string tmpPath = std::string{path} + ".tmp";
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return false;
+	try {
+		capnp::MallocMessageBuilder message;
+		fill(message.initRoot<Root>());
+		capnp::writeMessageToFd(fd, message);
+	} catch (kj::Exception& e) {
+		close(fd);
+		unlink(tmpPath.c_str());
+		return false;
+	}
+	close(fd);
+	return std::rename(tmpPath.c_str(), path) == 0;
+}
+
+/**
+ * @brief Reads the message published at path and converts it with parse(root).
+ * @returns std::nullopt if nothing is published at path, the file is malformed or truncated, or parse rejected it.
+ */
+template <typename T, typename Root, typename F>
+std::optional<T> readPublished(const char* path, F&& parse, capnp::ReaderOptions options = {}) noexcept {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return std::nullopt;
+	std::optional<T> ret;
+	try {
+		capnp::StreamFdMessageReader message(fd, options);
+		ret = parse(message.getRoot<Root>());
+	} catch (kj::Exception& e) {
+		/** Malformed or truncated file; behave as if nothing was published **/
+	}
+	close(fd);
+	return ret;
+}
+
+/**
+ * @brief The latest version of a published file, as a client sees it. Once a version was read, checks at most once a
+ * second if a new one was published; while there is none, checks on every call.
+ * @tparam T Provides Path and a static read() returning std::optional<T>.
+ */
+template <typename T>
+class PublishedFile final {
+private:
+	std::mutex mutex;
+	std::shared_ptr<const T> current;
+	std::chrono::steady_clock::time_point checked;
+	struct stat published = {};
+
+public:
+	/**
+	 * @returns the latest version or nullptr if there is none.
+	 * @param loaded Called with every new version that was read.
+	 */
+	template <typename F>
+	std::shared_ptr<const T> get(F&& loaded) {
+		std::lock_guard lock(mutex);
+		auto now = std::chrono::steady_clock::now();
+		if (current && now - checked < std::chrono::seconds{1})
+			return current;
+		checked = now;
+		struct stat st;
+		if (stat(T::Path, &st) != 0) {
+			current.reset();
+			return current;
+		}
+		if (!current || st.st_ino != published.st_ino || st.st_mtim.tv_sec != published.st_mtim.tv_sec ||
+			st.st_mtim.tv_nsec != published.st_mtim.tv_nsec) {
+			if (auto read = T::read()) {
+				current = std::make_shared<const T>(std::move(*read));
+				published = st;
+				loaded(*current);
+			} else {
+				current.reset();
+			}
+		}
+		return current;
+	}
+	std::shared_ptr<const T> get() { return get([](const T&) {}); }
+};
+
+#endif
\ No newline at end of file
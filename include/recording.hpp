@@ -0,0 +1,187 @@
+#ifndef RECORDING_HPP
+#define RECORDING_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A recording of the requests that the daemon served, such that cache policies and sizes can be evaluated
+ * offline on real traffic (see gitlabnss-replay).
+ *
+ * A recording starts with Magic, followed by one record per request: the time in microseconds since the epoch (8
+ * bytes), the method (1 byte), flags (1 byte), the length of the key (2 bytes) and the key, i.e., the ID or name that
+ * was looked up. All integers are little endian. Records are written back to back without framing since a capnp
+ * message per request would be several times as large as the request itself.
+ *
+ * Besides the requests, the daemon records what it learns from GitLab (LearnedFlag), such that the replay can cache
+ * users and groups under all the keys the daemon does: a fetched user is recorded with the method GetUserByID and the
+ * fields ID, username and then ID and name of each of their groups; a fetched group with GetGroupByID and the fields ID
+ * and name (see joinFields). Such a record precedes the record of the request during which it was learned.
+ */
+namespace recording {
+	constexpr char Magic[8] = {'G', 'L', 'N', 'S', 'R', 'E', 'C', '2'};
+	/** Recordings of older daemons, which lack what the daemon learned **/
+	constexpr char MagicV1[8] = {'G', 'L', 'N', 'S', 'R', 'E', 'C', '1'};
+	constexpr uint8_t HitFlag = 1;
+	constexpr uint8_t FoundFlag = 2;
+	constexpr uint8_t LearnedFlag = 4;
+
+	/** The methods of GitLabDaemon in the order of their ordinals. **/
+	enum class Method : uint8_t {
+		GetUserByID,
+		GetUserByName,
+		GetSSHKeys,
+		GetGroupByID,
+		GetGroupByName,
+		GetPasswdByID,
+		GetPasswdByName,
+		GetGroupRecordByID,
+		GetGroupRecordByName,
+		GetGroupIDsByName,
+		Count
+	};
+
+	constexpr const char* methodName(Method method) noexcept {
+		constexpr const char* names[] = {
+				"getUserByID",
+				"getUserByName",
+				"getSSHKeys",
+				"getGroupByID",
+				"getGroupByName",
+				"getPasswdByID",
+				"getPasswdByName",
+				"getGroupRecordByID",
+				"getGroupRecordByName",
+				"getGroupIDsByName",
+		};
+		return method < Method::Count ? names[static_cast<size_t>(method)] : "unknown";
+	}
+
+	struct Record {
+		std::chrono::microseconds time; /**< Since the epoch. **/
+		Method method;
+		bool hit;	/**< If the daemon answered without asking GitLab. **/
+		bool found; /**< If the daemon answered with a result (i.e., not with an error). **/
+		std::string key;
+		bool learned = false; /**< Not a request, but what the daemon learned from GitLab. **/
+	};
+
+	/**
+	 * @brief Joins the fields of a learned record into its key, separated by null characters.
+	 */
+	inline std::string joinFields(const std::vector<std::string>& fields) {
+		std::string ret;
+		for (const auto& field : fields) {
+			if (!ret.empty())
+				ret.push_back('\0');
+			ret.append(field);
+		}
+		return ret;
+	}
+	inline std::vector<std::string_view> splitFields(std::string_view key) {
+		std::vector<std::string_view> ret;
+		while (!key.empty()) {
+			auto end = key.find('\0');
+			ret.push_back(key.substr(0, end));
+			key.remove_prefix(end == std::string_view::npos ? key.size() : end + 1);
+		}
+		return ret;
+	}
+
+	class Writer final {
+	private:
+		std::ofstream out;
+
+	public:
+		/**
+		 * @brief Appends to the recording at the path; a new recording is started if the file does not exist. Fails if
+		 * the file is a recording of another version, which the records would not fit.
+		 */
+		bool open(const std::filesystem::path& path) {
+			if (std::ifstream existing{path, std::ios::binary}) {
+				char magic[sizeof(Magic)];
+				if (existing.read(magic, sizeof(magic)) && !std::equal(std::begin(magic), std::end(magic), Magic))
+					return false;
+			}
+			out.open(path, std::ios::binary | std::ios::app);
+			if (out && out.tellp() == 0)
+				out.write(Magic, sizeof(Magic));
+			return static_cast<bool>(out);
+		}
+		bool isOpen() const noexcept { return out.is_open(); }
+
+		void write(const Record& record) {
+			if (!out.is_open())
+				return;
+			auto key = std::string_view{record.key}.substr(0, UINT16_MAX);
+			uint64_t time = record.time.count();
+			char header[12];
+			for (unsigned i = 0; i < 8; ++i)
+				header[i] = static_cast<char>(time >> (8 * i));
+			header[8] = static_cast<char>(record.method);
+			header[9] = static_cast<char>(
+					(record.hit ? HitFlag : 0) | (record.found ? FoundFlag : 0) | (record.learned ? LearnedFlag : 0)
+			);
+			header[10] = static_cast<char>(key.size());
+			header[11] = static_cast<char>(key.size() >> 8);
+			out.write(header, sizeof(header));
+			out.write(key.data(), key.size());
+		}
+		void flush() { out.flush(); }
+	};
+
+	class Reader final {
+	private:
+		std::ifstream in;
+		bool complete = true;
+
+	public:
+		/**
+		 * @brief Opens the recording at the path; isOpen() is false if it does not exist or is not a recording.
+		 */
+		explicit Reader(const std::filesystem::path& path) : in(path, std::ios::binary) {
+			char magic[sizeof(Magic)];
+			if (in.read(magic, sizeof(magic)) && std::equal(std::begin(magic), std::end(magic), std::begin(MagicV1)))
+				complete = false;
+			else if (!in || !std::equal(std::begin(magic), std::end(magic), std::begin(Magic)))
+				in.close();
+		}
+		bool isOpen() const noexcept { return in.is_open(); }
+		/** false for recordings of older daemons, which lack what the daemon learned from GitLab **/
+		bool hasLearned() const noexcept { return complete; }
+
+		/**
+		 * @returns the next record or std::nullopt at the end of the recording. A truncated last record (e.g., since
+		 * the daemon was killed while writing it) is skipped.
+		 */
+		std::optional<Record> next() {
+			unsigned char header[12];
+			if (!in.is_open() || !in.read(reinterpret_cast<char*>(header), sizeof(header)))
+				return std::nullopt;
+			uint64_t time = 0;
+			for (unsigned i = 0; i < 8; ++i)
+				time |= static_cast<uint64_t>(header[i]) << (8 * i);
+			Record record{
+					.time = std::chrono::microseconds{time},
+					.method = static_cast<Method>(header[8]),
+					.hit = (header[9] & HitFlag) != 0,
+					.found = (header[9] & FoundFlag) != 0,
+					.key = std::string(header[10] | (header[11] << 8), '\0'),
+					.learned = (header[9] & LearnedFlag) != 0
+			};
+			if (!in.read(record.key.data(), record.key.size()))
+				return std::nullopt;
+			return record;
+		}
+	};
+} // namespace recording
+
+#endif
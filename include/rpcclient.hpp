@@ -5,11 +5,43 @@
 #include <kj/async-io.h>
 #include <protocol/messages.capnp.h>
 
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
 #include <filesystem>
 #include <format>
 #include <memory>
+#include <optional>
+
+/**
+ * @brief Returns a new ID for a request to the daemon, which the daemon reports in its slow-request log. The upper half
+ * is the caller's PID, such that the request can be attributed to a process.
+ */
+static uint64_t newRequestId() {
+	static std::atomic<uint32_t> counter{0};
+	return (static_cast<uint64_t>(getpid()) << 32) | counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Waits for the promise, but no longer than the timeout (0 waits forever).
+ * @returns std::nullopt if the promise did not resolve in time or failed (e.g., because the daemon hung up).
+ */
+template <typename T>
+static std::optional<T>
+waitWithDeadline(kj::AsyncIoContext& io, kj::Promise<T>&& promise, std::chrono::milliseconds timeout) {
+	try {
+		if (timeout.count() == 0)
+			return promise.wait(io.waitScope);
+		auto& timer = io.provider->getTimer();
+		return timer.timeoutAfter(timeout.count() * kj::MILLISECONDS, kj::mv(promise)).wait(io.waitScope);
+	} catch (kj::Exception& e) {
+		return std::nullopt;
+	}
+}
 
-static std::shared_ptr<GitLabDaemon::Client> initClient(kj::AsyncIoContext& io) {
+static std::shared_ptr<GitLabDaemon::Client>
+initClient(kj::AsyncIoContext& io, std::chrono::milliseconds timeout = std::chrono::milliseconds{0}) {
 	try {
 		auto& waitScope = io.waitScope;
 		auto socketPath = std::filesystem::current_path().root_path() / "var" / "run" / "gitlabnss.sock";
@@ -23,10 +55,15 @@ static std::shared_ptr<GitLabDaemon::Client> initClient(kj::AsyncIoContext& io)
 			explicit Anon(kj::Own<kj::AsyncIoStream>&& conn)
 					: conn(std::move(conn)), client(*(this->conn)), daemon(client.bootstrap().castAs<GitLabDaemon>()) {}
 		};
-		auto anon = std::make_shared<Anon>(std::move(addr->connect().wait(waitScope)));
+		auto conn = waitWithDeadline(io, addr->connect(), timeout);
+		if (!conn)
+			return nullptr;
+		auto anon = std::make_shared<Anon>(std::move(*conn));
 		return std::shared_ptr<GitLabDaemon::Client>{anon, &anon->daemon};
 	} catch (std::exception& e) {
 		return nullptr;
+	} catch (kj::Exception& e) {
+		return nullptr;
 	}
 }
 
@@ -0,0 +1,96 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include "config.hpp"
+
+#include <kj/async.h>
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+
+/**
+ * @brief Decides which client's request the daemon serves next.
+ *
+ * Requests are identified by the credentials of the peer of the socket (SO_PEERCRED). Requests by root are served
+ * first, round robin between processes, such that a runaway root process does not hold up the others (e.g., sshd). All
+ * other requests are served round robin between users. A request is rejected right away if its process has too many
+ * requests queued or, unless it is root's, its user has too many requests queued or exceeds its rate.
+ */
+class Scheduler final {
+public:
+	/**
+	 * @brief Tracks one admitted request. Destroying it (once the request was served or cancelled) frees the request's
+	 * spot in the queue and, if the request was dispatched, lets the next request run.
+	 */
+	class Slot final {
+	private:
+		Scheduler& scheduler;
+		ucred peer;
+		uint64_t id;
+
+	public:
+		Slot(Scheduler& scheduler, const ucred& peer, uint64_t id) noexcept
+				: scheduler(scheduler), peer(peer), id(id) {}
+		~Slot() { scheduler.release(peer, id); }
+		KJ_DISALLOW_COPY_AND_MOVE(Slot);
+	};
+
+	struct Admission {
+		kj::Promise<void> turn; /**< Resolves once the request may run. **/
+		kj::Own<Slot> slot;		/**< Must be kept alive until the request was served. **/
+	};
+
+private:
+	using Clock = std::chrono::steady_clock;
+	struct Waiting {
+		kj::Own<kj::PromiseFulfiller<void>> fulfiller;
+		uint64_t slot;
+	};
+	using Queue = std::deque<Waiting>;
+
+	struct Client {
+		unsigned pending = 0;
+		double tokens;
+		Clock::time_point refilled;
+		Queue queue;
+	};
+
+	const Config::Limits& limits;
+	std::map<uid_t, Client> clients;
+	std::map<pid_t, unsigned> pendingPerPID;
+	std::deque<uid_t> roundRobin; /**< Users with queued requests in the order they are served next. **/
+	std::map<pid_t, Queue> rootQueues;
+	std::deque<pid_t> rootRoundRobin; /**< Root's processes with queued requests, served before all users. **/
+	uint64_t nextSlot = 1;
+	/**
+	 * The slot of the request that was dispatched last, or 0 if none is running. It is set when the request's turn is
+	 * fulfilled, not when the request starts, since the request may be cancelled in between.
+	 */
+	uint64_t running = 0;
+	unsigned rejected = 0;
+
+	static bool isPrivileged(const ucred& peer) noexcept { return peer.uid == 0; }
+
+	Client& getClient(uid_t uid);
+	void dispatch();
+	void release(const ucred& peer, uint64_t slot);
+
+public:
+	explicit Scheduler(const Config::Limits& limits) noexcept;
+
+	/**
+	 * @brief Queues a request of the given peer.
+	 * @returns std::nullopt if the request is to be rejected. Otherwise, the admission whose turn resolves once the
+	 * request may run.
+	 */
+	std::optional<Admission> admit(const ucred& peer);
+
+	unsigned numRejected() const noexcept { return rejected; }
+};
+
+#endif
\ No newline at end of file
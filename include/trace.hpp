@@ -0,0 +1,122 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include "config.hpp"
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace spdlog {
+	class logger;
+}
+
+/**
+ * @brief Records how long the phases of a single request took (queueing, cache lookups, requests to GitLab, parsing,
+ * ...). The trace of the request that is currently handled on a thread is installed with Trace::Scope, such that code
+ * deep down (e.g., gitlab::GitLab) can add to it without passing it around.
+ */
+class Trace final {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	struct Span {
+		std::string name;
+		std::string detail; /**< E.g., the URL requested from GitLab. **/
+		Clock::duration begin; /**< Relative to the start of the request. **/
+		Clock::duration duration;
+	};
+
+	/**
+	 * @brief Measures a span from its construction to its destruction and adds it to the current trace, if any.
+	 */
+	class Timer final {
+	private:
+		Trace* trace;
+		std::string name;
+		std::string detail;
+		Clock::time_point begin;
+
+	public:
+		Timer(std::string name, std::string detail = "")
+				: trace(Trace::current()), name(std::move(name)), detail(std::move(detail)), begin(Clock::now()) {}
+		~Timer() {
+			if (trace != nullptr)
+				trace->record(std::move(name), std::move(detail), begin, Clock::now());
+		}
+		/** Appends to the span's detail (e.g., the response status once it is known) **/
+		void annotate(std::string_view text) {
+			if (trace != nullptr)
+				detail.append(text);
+		}
+		Timer(const Timer&) = delete;
+		Timer& operator=(const Timer&) = delete;
+	};
+
+	/**
+	 * @brief Installs the trace as the current trace of this thread until the scope is left.
+	 */
+	class Scope final {
+	private:
+		Trace* previous;
+
+	public:
+		explicit Scope(Trace* trace) noexcept : previous(currentTrace) { currentTrace = trace; }
+		~Scope() { currentTrace = previous; }
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	};
+
+private:
+	static thread_local Trace* currentTrace;
+
+	uint64_t requestId;
+	std::string method;
+	uid_t uid;
+	pid_t pid;
+	Clock::time_point start;
+	Clock::time_point end;
+	std::string outcome = "cancelled"; /**< Unless the request was served or failed before it was dropped. **/
+	mutable std::mutex mutex; /**< Spans may be recorded by helper threads of the request. **/
+	std::vector<Span> spans;
+
+public:
+	Trace(uint64_t requestId, std::string method, uid_t uid, pid_t pid);
+
+	static Trace* current() noexcept { return currentTrace; }
+
+	void record(std::string name, std::string detail, Clock::time_point begin, Clock::time_point end);
+	/** Marks the request as done. **/
+	void finish() noexcept { end = Clock::now(); }
+	/** How the request ended, e.g., "served" or the error it failed with. **/
+	void setOutcome(std::string outcome) { this->outcome = std::move(outcome); }
+	Clock::duration duration() const noexcept { return end - start; }
+	/** Checks if a span of the name was recorded (e.g., if GitLab was asked). **/
+	bool contains(std::string_view name) const;
+
+	/** Renders the trace as a single line of JSON. **/
+	std::string toJSON() const;
+};
+
+/**
+ * @brief Writes the traces of requests that took longer than the configured threshold to a file, one JSON object per
+ * line.
+ */
+class SlowLog final {
+private:
+	std::chrono::milliseconds threshold;
+	std::shared_ptr<spdlog::logger> logger;
+
+public:
+	explicit SlowLog(const Config& config);
+
+	void submit(const Trace& trace) const;
+};
+
+#endif
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <clientconfig.hpp>
 #include <error.hpp>
 #include <rpcclient.hpp>
 
@@ -6,9 +7,11 @@
 int main(int argc, char* argv[]) {
 	if (argc != 2)
 		return -1;
+	// sshd waits for this command; never hang it for longer than the daemon's configured timeout
+	auto config = ClientConfig::read();
+	auto timeout = config ? config->timeout : ClientConfig::DefaultTimeout;
 	auto io = kj::setupAsyncIo();
-	auto& waitScope = io.waitScope;
-	auto daemon = initClient(io);
+	auto daemon = initClient(io, timeout);
 
 	if (!daemon)
 		return -2;
@@ -16,7 +19,11 @@ int main(int argc, char* argv[]) {
 	// Get the user ID from the username via RPC to the daemon
 	auto userreq = daemon->getUserByNameRequest();
 	userreq.setName(argv[1]);
-	auto userresp = userreq.send().wait(waitScope);
+	userreq.setRequestId(newRequestId());
+	auto userresponse = waitWithDeadline(io, userreq.send(), timeout);
+	if (!userresponse)
+		return static_cast<int>(Error::Timeout);
+	auto& userresp = *userresponse;
 	if (static_cast<Error>(userresp.getErrcode()) != Error::Ok)
 		return userresp.getErrcode();
 
@@ -26,7 +33,11 @@ int main(int argc, char* argv[]) {
 	// Get the ssh public keys from user by ID via RPC to the daemon
 	auto keyreq = daemon->getSSHKeysRequest();
 	keyreq.setId(userresp.getUser().getId());
-	auto keyresp = keyreq.send().wait(waitScope);
+	keyreq.setRequestId(newRequestId());
+	auto keyresponse = waitWithDeadline(io, keyreq.send(), timeout);
+	if (!keyresponse)
+		return static_cast<int>(Error::Timeout);
+	auto& keyresp = *keyresponse;
 	if (static_cast<Error>(keyresp.getErrcode()) != Error::Ok)
 		return keyresp.getErrcode();
 
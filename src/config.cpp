@@ -14,6 +14,16 @@ static std::optional<std::string> tryReadSecret(const std::filesystem::path& pat
 	return std::nullopt;
 }
 
+static std::vector<std::string> tolist(const toml::array* array) {
+	if (array == nullptr)
+		return {};
+	std::vector<std::string> ret;
+	for (const auto& value : *array)
+		if (auto val = value.value<std::string>())
+			ret.push_back(*val);
+	return ret;
+}
+
 static std::map<std::string, std::string> tomap(const toml::table* table) {
 	if (table == nullptr) { /** \todo notify user of error? **/
 		return {};
@@ -41,7 +51,15 @@ Config Config::fromFile(const std::filesystem::path& file) noexcept {
 								 Config::DefaultSocketPath
 						 )},
 						 .socketPerms = table["general"]["socket_permissions"].value_or(Config::DefaultSocketPerms),
-						 .socketOwner = table["general"]["socket_owner"].value_or(Config::DefaultSocketOwner)},
+						 .socketOwner = table["general"]["socket_owner"].value_or(Config::DefaultSocketOwner),
+						 .statsInterval = table["general"]["stats_interval"].value_or(Config::DefaultStatsInterval),
+						 .slowThreshold = table["general"]["slow_threshold"].value_or(Config::DefaultSlowThreshold),
+						 .slowLog = std::filesystem::path{
+								 table["general"]["slow_log"].value_or(Config::DefaultSlowLog)
+						 },
+						 .recordFile = std::filesystem::path{
+								 table["general"]["record_file"].value_or(Config::DefaultRecordFile)
+						 }},
 				.gitlabapi =
 						{.baseUrl = table["gitlabapi"]["base_url"].value_or(""s),
 						 .apikey = table["gitlabapi"]["secret"]
@@ -50,7 +68,14 @@ Config Config::fromFile(const std::filesystem::path& file) noexcept {
 											   return file.parent_path() / path;
 										   })
 										   .and_then(tryReadSecret)
-										   .value_or(""s)},
+										   .value_or(""s),
+						 .timeout = table["gitlabapi"]["timeout"].value_or(Config::DefaultAPITimeout)},
+				.client =
+						{.timeout = table["client"]["timeout"].value_or(Config::DefaultClientTimeout),
+						 .breakerThreshold =
+								 table["client"]["breaker_threshold"].value_or(Config::DefaultBreakerThreshold),
+						 .breakerCooldown =
+								 table["client"]["breaker_cooldown"].value_or(Config::DefaultBreakerCooldown)},
 				.nss = {.homesRoot = std::filesystem::path{table["nss"]["homes_root"].value_or("/homes/"s)},
 						.createHomedirs = table["nss"]["create_homedirs"].value_or(false),
 						.homePerms = table["nss"]["homes_permissions"].value_or(Config::DefaultHomePerms),
@@ -61,7 +86,35 @@ Config Config::fromFile(const std::filesystem::path& file) noexcept {
 						.primaryGroup = table["nss"]["primary_group"].value<std::string>(),
 						.userCachesize = table["nss"]["user_cachesize"].value_or(Config::DefaultUserCachesize),
 						.groupCachesize = table["nss"]["group_cachesize"].value_or(Config::DefaultGroupCachesize),
-						.groupMapping = tomap(table["nss"]["group_mapping"].as_table())}
+						.userCacheBytes = table["nss"]["user_cache_bytes"].value_or(Config::DefaultUserCacheBytes),
+						.groupCacheBytes = table["nss"]["group_cache_bytes"].value_or(Config::DefaultGroupCacheBytes),
+						.cacheTTL = table["nss"]["cache_ttl"].value_or(Config::DefaultCacheTTL),
+						.cacheAdmission = table["nss"]["cache_admission"].value_or(Config::DefaultCacheAdmission),
+						.cacheAging = table["nss"]["cache_aging"].value_or(Config::DefaultCacheAging),
+						.groupMapping = tomap(table["nss"]["group_mapping"].as_table()),
+						.keysTTL = table["nss"]["keys_ttl"].value_or(Config::DefaultKeysTTL),
+						.prefetch = table["nss"]["prefetch"].value_or(Config::DefaultPrefetch)},
+				.limits =
+						{.perUIDRequests = table["limits"]["per_uid_requests"].value_or(Config::DefaultPerUIDRequests),
+						 .perPIDRequests = table["limits"]["per_pid_requests"].value_or(Config::DefaultPerPIDRequests),
+						 .perUIDRate = table["limits"]["per_uid_rate"].value_or(Config::DefaultPerUIDRate),
+						 .perUIDBurst = table["limits"]["per_uid_burst"].value_or(Config::DefaultPerUIDBurst)},
+				.systemhooks =
+						{.listen = table["systemhooks"]["listen"].value_or(""s),
+						 .secret = table["systemhooks"]["secret"]
+										   .value<std::string>()
+										   .transform([file](const std::filesystem::path& path) {
+											   return file.parent_path() / path;
+										   })
+										   .and_then(tryReadSecret)
+										   .value_or(""s)},
+				.filter = {.enabled = table["filter"]["enabled"].value_or(false),
+						   .refreshInterval =
+								   table["filter"]["refresh_interval"].value_or(Config::DefaultFilterRefreshInterval),
+						   .names = table["filter"]["names"].value_or(false)},
+				.warmup = {.groups = tolist(table["warmup"]["groups"].as_array()),
+						   .refreshInterval =
+								   table["warmup"]["refresh_interval"].value_or(Config::DefaultWarmupRefreshInterval)}
 		};
 	}
 }
\ No newline at end of file
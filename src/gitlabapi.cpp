@@ -1,10 +1,15 @@
 #include <gitlabapi.hpp>
+#include <trace.hpp>
 
 #include <cpr/cpr.h>
 #include <rapidjson/document.h>
 
+#include <chrono>
 #include <expected>
 #include <format>
+#include <future>
+#include <string>
+#include <string_view>
 
 using gitlab::GitLab;
 using gitlab::Group;
@@ -12,9 +17,45 @@ using gitlab::GroupID;
 using gitlab::User;
 using gitlab::UserID;
 
-static std::expected<rapidjson::Document, Error> fetch(const Config& config, std::string url) noexcept {
-	auto resp = cpr::Get(cpr::Url{url}, cpr::Bearer{config.gitlabapi.apikey});
-	if (resp.status_code == 404)
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Extracts the URL of the next page from a Link header, e.g., `<https://...>; rel="next", <...>; rel="first"`.
+ * @returns the URL or an empty string if there is no next page.
+ */
+static std::string nextPage(std::string_view link) {
+	while (!link.empty()) {
+		auto end = link.find(',');
+		auto entry = link.substr(0, end);
+		link.remove_prefix(end == std::string_view::npos ? link.size() : end + 1);
+		auto open = entry.find('<'), close = entry.find('>');
+		if (open != std::string_view::npos && close != std::string_view::npos && open < close &&
+			entry.find("rel=\"next\"", close) != std::string_view::npos)
+			return std::string{entry.substr(open + 1, close - open - 1)};
+	}
+	return {};
+}
+
+/**
+ * @brief Fetches the URL, giving up once the deadline passes.
+ * @param next If not null, receives the URL of the next page of a listing (empty if it was the last page).
+ */
+static std::expected<rapidjson::Document, Error>
+fetch(const Config& config, std::string url, Clock::time_point deadline, std::string* next = nullptr) noexcept {
+	auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+	if (timeout.count() <= 0)
+		return std::unexpected(Error::Timeout);
+	cpr::Response resp;
+	{
+		Trace::Timer timer("upstream", url);
+		resp = cpr::Get(cpr::Url{url}, cpr::Bearer{config.gitlabapi.apikey}, cpr::Timeout{timeout});
+		timer.annotate(std::format(" -> {}", resp.error ? resp.error.message : std::to_string(resp.status_code)));
+	}
+	if (resp.error.code == cpr::ErrorCode::OPERATION_TIMEDOUT)
+		return std::unexpected(Error::Timeout);
+	else if (resp.error)
+		return std::unexpected(Error::ServerError);
+	else if (resp.status_code == 404)
 		return std::unexpected(Error::NotFound);
 	else if (resp.status_code == 401)
 		return std::unexpected(Error::AuthenticationError);
@@ -23,17 +64,30 @@ static std::expected<rapidjson::Document, Error> fetch(const Config& config, std
 	else if (resp.status_code >= 500)
 		return std::unexpected(Error::ServerError);
 	rapidjson::Document json;
-	json.Parse(resp.text.c_str());
+	{
+		Trace::Timer timer("parse");
+		json.Parse(resp.text.c_str());
+	}
 	if (json.HasParseError())
 		return std::unexpected(Error::ResponseFormatError);
+	if (next != nullptr)
+		*next = nextPage(resp.header["link"]);
 	return json;
 }
 
 GitLab::GitLab(const Config& config) noexcept : config(config) {}
 
+GitLab::Deadline GitLab::newDeadline() const {
+	return Clock::now() + std::chrono::milliseconds{config.gitlabapi.timeout};
+}
+
 Error GitLab::fetchUserByUsername(std::string username, User& user) const {
+	return fetchUserByUsername(username, user, newDeadline());
+}
+
+Error GitLab::fetchUserByUsername(const std::string& username, User& user, Deadline deadline) const {
 	/**  \todo should not hurt to apply url-encoding of the username **/
-	auto fetched = fetch(config, std::format("{}/users?username={}", config.gitlabapi.baseUrl, username));
+	auto fetched = fetch(config, std::format("{}/users?username={}", config.gitlabapi.baseUrl, username), deadline);
 	if (!fetched.has_value())
 		return fetched.error();
 	auto& json = fetched.value();
@@ -49,8 +103,10 @@ Error GitLab::fetchUserByUsername(std::string username, User& user) const {
 	return Error::Ok;
 }
 
-Error GitLab::fetchUserByID(UserID id, User& user) const {
-	auto fetched = fetch(config, std::format("{}/users/{}", config.gitlabapi.baseUrl, id));
+Error GitLab::fetchUserByID(UserID id, User& user) const { return fetchUserByID(id, user, newDeadline()); }
+
+Error GitLab::fetchUserByID(UserID id, User& user, Deadline deadline) const {
+	auto fetched = fetch(config, std::format("{}/users/{}", config.gitlabapi.baseUrl, id), deadline);
 	if (!fetched.has_value())
 		return fetched.error();
 	auto& json = fetched.value();
@@ -65,7 +121,11 @@ Error GitLab::fetchUserByID(UserID id, User& user) const {
 }
 
 Error GitLab::fetchAuthorizedKeys(UserID id, std::vector<std::string>& keys) const {
-	auto fetched = fetch(config, std::format("{}/users/{}/keys", config.gitlabapi.baseUrl, id));
+	return fetchAuthorizedKeys(id, keys, newDeadline());
+}
+
+Error GitLab::fetchAuthorizedKeys(UserID id, std::vector<std::string>& keys, Deadline deadline) const {
+	auto fetched = fetch(config, std::format("{}/users/{}/keys", config.gitlabapi.baseUrl, id), deadline);
 	if (!fetched.has_value())
 		return fetched.error();
 	auto& json = fetched.value();
@@ -78,8 +138,10 @@ Error GitLab::fetchAuthorizedKeys(UserID id, std::vector<std::string>& keys) con
 	return Error::Ok;
 }
 
-Error GitLab::fetchGroups(User& user) const {
-	auto fetched = fetch(config, std::format("{}/users/{}/memberships", config.gitlabapi.baseUrl, user.id));
+Error GitLab::fetchGroups(User& user) const { return fetchGroups(user, newDeadline()); }
+
+Error GitLab::fetchGroups(User& user, Deadline deadline) const {
+	auto fetched = fetch(config, std::format("{}/users/{}/memberships", config.gitlabapi.baseUrl, user.id), deadline);
 	if (!fetched.has_value())
 		return fetched.error();
 	auto& json = fetched.value();
@@ -97,7 +159,8 @@ Error GitLab::fetchGroups(User& user) const {
 
 Error GitLab::fetchGroupByName(const std::string& groupname, Group& group) const {
 	/**  \todo should not hurt to apply url-encoding of the groupname **/
-	auto fetched = fetch(config, std::format("{}/groups?search={}&active=true", config.gitlabapi.baseUrl, groupname));
+	auto url = std::format("{}/groups?search={}&active=true", config.gitlabapi.baseUrl, groupname);
+	auto fetched = fetch(config, url, newDeadline());
 	if (!fetched.has_value())
 		return fetched.error();
 	auto& json = fetched.value();
@@ -115,7 +178,8 @@ Error GitLab::fetchGroupByName(const std::string& groupname, Group& group) const
 }
 
 Error GitLab::fetchGroupByID(GroupID id, Group& group) const {
-	auto fetched = fetch(config, std::format("{}/groups/{}?with_projects=false", config.gitlabapi.baseUrl, id));
+	auto url = std::format("{}/groups/{}?with_projects=false", config.gitlabapi.baseUrl, id);
+	auto fetched = fetch(config, url, newDeadline());
 	if (!fetched.has_value())
 		return fetched.error();
 	auto& json = fetched.value();
@@ -125,4 +189,121 @@ Error GitLab::fetchGroupByID(GroupID id, Group& group) const {
 	group.id = groupJson["id"].Get<decltype(group.id)>();
 	group.name = groupJson["name"].GetString();
 	return Error::Ok;
+}
+
+/**
+ * @brief Fetches all pages of a listing, following the links to the next page that GitLab sends, and calls visit for
+ * each element until visit returns false.
+ */
+template <typename F>
+static Error forEachPage(const Config& config, std::string url, F&& visit) {
+	while (!url.empty()) {
+		// Each page is a request of its own; enumerating takes as long as it takes
+		auto deadline = Clock::now() + std::chrono::milliseconds{config.gitlabapi.timeout};
+		auto fetched = fetch(config, url, deadline, &url);
+		if (!fetched.has_value())
+			return fetched.error();
+		auto& json = fetched.value();
+		if (!json.IsArray())
+			return Error::ResponseFormatError;
+		for (const auto& element : json.GetArray())
+			if (!visit(element))
+				return Error::Ok;
+	}
+	return Error::Ok;
+}
+
+Error GitLab::forEachUser(const std::function<bool(const User&)>& visit) const {
+	// With offset pagination, a user deleted while paging would shift the later pages and skip a user. Keyset
+	// pagination continues after the last ID seen instead.
+	auto url = std::format("{}/users?pagination=keyset&order_by=id&sort=asc&per_page=100", config.gitlabapi.baseUrl);
+	return forEachPage(config, url, [&visit](const auto& userJson) {
+		return visit(User{
+				.id = userJson["id"].template Get<UserID>(),
+				.username = userJson["username"].GetString(),
+				.name = userJson["name"].GetString(),
+				.state = userJson["state"].GetString()
+		});
+	});
+}
+
+Error GitLab::forEachGroup(const std::function<bool(const Group&)>& visit) const {
+	// GitLab only offers keyset pagination of groups by name and to anonymous callers. Ordered by ID, at least groups
+	// created while paging are appended instead of shifting the later pages.
+	auto url = std::format("{}/groups?all_available=true&order_by=id&sort=asc&per_page=100", config.gitlabapi.baseUrl);
+	return forEachPage(config, url, [&visit](const auto& groupJson) {
+		return visit(Group{.id = groupJson["id"].template Get<GroupID>(), .name = groupJson["name"].GetString()});
+	});
+}
+
+Error GitLab::forEachMember(GroupID id, const std::function<bool(const User&)>& visit) const {
+	auto url = std::format("{}/groups/{}/members/all?per_page=100", config.gitlabapi.baseUrl, id);
+	return forEachPage(config, url, [&visit](const auto& userJson) {
+		return visit(User{
+				.id = userJson["id"].template Get<UserID>(),
+				.username = userJson["username"].GetString(),
+				.name = userJson["name"].GetString(),
+				.state = userJson["state"].GetString()
+		});
+	});
+}
+
+/**
+ * @brief Starts a request on its own thread. If no thread can be started, the request is deferred until the returned
+ * future is waited for. Either way, the request is recorded in the trace of the calling request.
+ */
+template <typename F>
+static std::future<std::invoke_result_t<F>> fetchConcurrently(F&& request) {
+	return std::async(
+			std::launch::async | std::launch::deferred,
+			[trace = Trace::current(), request = std::forward<F>(request)]() mutable {
+				Trace::Scope scope(trace);
+				return request();
+			}
+	);
+}
+
+std::future<void> GitLab::fetchKeysConcurrently(
+		UserID id, std::expected<std::vector<std::string>, Error>* keys, Deadline deadline
+) const {
+	if (keys == nullptr)
+		return {};
+	return fetchConcurrently([this, id, keys, deadline] {
+		std::vector<std::string> fetched;
+		if (Error err = fetchAuthorizedKeys(id, fetched, deadline); err != Error::Ok)
+			*keys = std::unexpected(err);
+		else
+			*keys = std::move(fetched);
+	});
+}
+
+Error GitLab::fetchUserWithGroupsByID(UserID id, User& user, std::expected<std::vector<std::string>, Error>* keys)
+		const {
+	auto deadline = newDeadline();
+	User member{.id = id};
+	auto groups = fetchConcurrently([this, &member, deadline] { return fetchGroups(member, deadline); });
+	auto keysFetched = fetchKeysConcurrently(id, keys, deadline);
+	Error err = fetchUserByID(id, user, deadline);
+	// Always wait for all requests since they reference our locals
+	Error groupsErr = groups.get();
+	if (keysFetched.valid())
+		keysFetched.wait();
+	if (err != Error::Ok)
+		return err;
+	user.groups = std::move(member.groups);
+	return groupsErr;
+}
+
+Error GitLab::fetchUserWithGroupsByUsername(
+		const std::string& username, User& user, std::expected<std::vector<std::string>, Error>* keys
+) const {
+	// The requests after the first share what is left of the lookup's time
+	auto deadline = newDeadline();
+	if (Error err = fetchUserByUsername(username, user, deadline); err != Error::Ok)
+		return err;
+	auto keysFetched = fetchKeysConcurrently(user.id, keys, deadline);
+	Error err = fetchGroups(user, deadline);
+	if (keysFetched.valid())
+		keysFetched.wait();
+	return err;
 }
\ No newline at end of file
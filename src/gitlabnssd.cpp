@@ -3,28 +3,47 @@
  * @brief The gitlabnss daemon executable
  */
 
+#include <accountfilter.hpp>
+#include <cache.hpp>
+#include <clientconfig.hpp>
 #include <config.hpp>
 #include <gitlabapi.hpp>
-
-#include <stlcache/stlcache.hpp>
+#include <interner.hpp>
+#include <recording.hpp>
+#include <scheduler.hpp>
+#include <trace.hpp>
 
 #include <spdlog/sinks/rotating_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
-#include <capnp/ez-rpc.h>
+#include <capnp/rpc-twoparty.h>
+#include <kj/async-io.h>
+#include <kj/compat/http.h>
 #include <protocol/messages.capnp.h>
 
+#include <rapidjson/document.h>
+
 #include <grp.h>
 
 #include <any>
+#include <chrono>
+#include <condition_variable>
 #include <csignal>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <ranges>
+#include <set>
 #include <string>
+#include <string_view>
 #include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_set>
 #include <vector>
 
 namespace fs = std::filesystem;
@@ -48,36 +67,375 @@ static void initLogger() {
 	spdlog::set_default_logger(logger);
 }
 
-// Aging set to 30*60 seconds (aka .5 h); that is, an entry that was used n times will be deleted after n/2 hours
 template <typename K, typename V>
-using Cache = stlcache::cache<K, V, stlcache::policy_lfuaging<60 * 60>>;
+using Cache = LookupCache<K, V>;
+
+/** For how long keys that were fetched ahead of time may be served if keys are not cached otherwise (keys_ttl = 0) **/
+static constexpr std::chrono::seconds PrefetchedKeysLifetime{10};
+
+/**
+ * @brief The options of each cache of users, i.e., of the usercache, passwdcache, gidcache and (if keys are cached)
+ * keycache. They share user_cache_bytes in equal parts, such that all of them together stay within the budget.
+ */
+static CacheOptions userCacheOptions(const Config& config) {
+	size_t caches = config.nss.keysTTL > 0 ? 4 : 3;
+	return CacheOptions{
+			.maxEntries = config.nss.userCachesize,
+			.maxBytes = config.nss.userCacheBytes / caches,
+			.ttl = std::chrono::seconds{config.nss.cacheTTL},
+			.admission = config.nss.cacheAdmission,
+			.agingFactor = config.nss.cacheAging
+	};
+}
+/** The groupcache and grentcache share group_cache_bytes in equal parts. **/
+static CacheOptions groupCacheOptions(const Config& config) {
+	return CacheOptions{
+			.maxEntries = config.nss.groupCachesize,
+			.maxBytes = config.nss.groupCacheBytes / 2,
+			.ttl = std::chrono::seconds{config.nss.cacheTTL},
+			.admission = config.nss.cacheAdmission,
+			.agingFactor = config.nss.cacheAging
+	};
+}
+
+/**
+ * @brief The cached form of a gitlab::User. The username and state are interned and the groups are only referenced by
+ * their IDs (their names are kept once per group in GitLabDaemonImpl::groupNames), since the same few values would
+ * otherwise be copied into thousands of entries.
+ */
+struct CachedUser {
+	gitlab::UserID id;
+	std::string_view username;
+	std::string_view state;
+	std::string name;
+	std::vector<gitlab::GroupID> groups;
+};
+
+/**
+ * @brief The cached form of a gitlab::Group with an interned name.
+ */
+struct CachedGroup {
+	gitlab::GroupID id;
+	std::string_view name;
+};
+
+/**
+ * @brief A passwd entry that is rendered exactly as the NSS module hands it out (see PasswdRecord in messages.capnp).
+ * The strings are stored null-terminated in data and referenced by their offset into data.
+ */
+struct PasswdEntry {
+	uid_t uid;
+	gid_t gid;
+	std::string data;
+	uint32_t name, passwd, gecos, dir, shell;
+};
+
+/**
+ * @brief The group counterpart of PasswdEntry (see GroupRecord in messages.capnp).
+ */
+struct GroupEntry {
+	gid_t gid;
+	std::string data;
+	uint32_t name, passwd;
+};
+
+/**
+ * @brief The newline separated SSH keys of a user and when they were fetched from GitLab.
+ */
+struct KeysEntry {
+	std::string keys;
+	std::chrono::steady_clock::time_point fetched;
+};
+
+template <>
+struct Footprint<CachedUser> {
+	static size_t of(const CachedUser& user) noexcept {
+		return sizeof(CachedUser) - sizeof(std::string) - sizeof(std::vector<gitlab::GroupID>) +
+			   Footprint<std::string>::of(user.name) + Footprint<std::vector<gitlab::GroupID>>::of(user.groups);
+	}
+};
+
+template <>
+struct Footprint<PasswdEntry> {
+	static size_t of(const PasswdEntry& entry) noexcept {
+		return sizeof(PasswdEntry) - sizeof(std::string) + Footprint<std::string>::of(entry.data);
+	}
+};
+
+template <>
+struct Footprint<GroupEntry> {
+	static size_t of(const GroupEntry& entry) noexcept {
+		return sizeof(GroupEntry) - sizeof(std::string) + Footprint<std::string>::of(entry.data);
+	}
+};
+
+template <>
+struct Footprint<KeysEntry> {
+	static size_t of(const KeysEntry& entry) noexcept {
+		return sizeof(KeysEntry) - sizeof(std::string) + Footprint<std::string>::of(entry.keys);
+	}
+};
+
+/**
+ * @brief Interned strings are null-terminated, so they can be handed to capnp without a copy.
+ */
+static capnp::Text::Reader toText(std::string_view interned) {
+	return capnp::Text::Reader(interned.data(), interned.size());
+}
+
+/**
+ * @brief Appends the string with a terminating null character to data and returns the offset it was written to.
+ */
+static uint32_t appendString(std::string& data, std::string_view str) {
+	auto offset = static_cast<uint32_t>(data.size());
+	data.append(str);
+	data.push_back('\0');
+	return offset;
+}
+
+/**
+ * @brief Runs work on a thread of its own right away and then every interval (only once if the interval is 0) until it
+ * is destroyed. The work is passed the thread's stop token, such that it can give up early on shutdown. Declare it
+ * after everything the work uses, such that the thread is joined before those are destroyed.
+ */
+class PeriodicWorker final {
+private:
+	std::jthread thread;
+
+public:
+	PeriodicWorker(std::chrono::seconds interval, std::function<void(std::stop_token)> work)
+			: thread([interval, work = std::move(work)](std::stop_token stop) {
+				  std::mutex sleepMutex;
+				  std::condition_variable_any wakeup;
+				  while (!stop.stop_requested()) {
+					  work(stop);
+					  if (interval.count() == 0)
+						  break;
+					  std::unique_lock lock(sleepMutex);
+					  wakeup.wait_for(lock, stop, interval, [] { return false; });
+				  }
+			  }) {}
+};
+
+/**
+ * @brief Keeps the published AccountFilter up to date. The filter is rebuilt from all users and groups on GitLab
+ * periodically on a thread of its own, since enumerating them takes a request per 100 accounts. Accounts that the
+ * daemon learns about in between (e.g., through system hooks) are added right away.
+ */
+class FilterPublisher final {
+private:
+	using Kind = AccountFilter::Kind;
+	using Accounts = std::vector<std::pair<unsigned, std::string>>;
+
+	const gitlab::GitLab& gitlab;
+	std::chrono::seconds interval;
+	bool names;
+
+	std::mutex mutex;
+	AccountFilter filter;
+	bool rebuilding = false;
+	Accounts learnedUsers; /**< Users learned while a rebuild is running, which it has to include. **/
+	Accounts learnedGroups;
+	PeriodicWorker worker;
+
+	void publish() {
+		++filter.generation;
+		if (filter.write())
+			spdlog::info("Published generation {} of {}", filter.generation, AccountFilter::Path);
+		else
+			spdlog::error("Failed to write {} with errno {}", AccountFilter::Path, errno);
+	}
+
+	void rebuild(std::stop_token stop) {
+		{
+			std::lock_guard lock(mutex);
+			rebuilding = true;
+			learnedUsers.clear();
+			learnedGroups.clear();
+		}
+		spdlog::info("Enumerating all users and groups for {}", AccountFilter::Path);
+		Accounts users, groups;
+		Error err = gitlab.forEachUser([&](const gitlab::User& user) {
+			users.emplace_back(user.id, user.username);
+			return !stop.stop_requested();
+		});
+		if (err == Error::Ok) {
+			err = gitlab.forEachGroup([&](const gitlab::Group& group) {
+				groups.emplace_back(group.id, group.name);
+				return !stop.stop_requested();
+			});
+		}
+		std::lock_guard lock(mutex);
+		rebuilding = false;
+		if (stop.stop_requested())
+			return;
+		if (err != Error::Ok) {
+			spdlog::error("Failed to enumerate users and groups with error {}", static_cast<unsigned>(err));
+			return;
+		}
+		users.insert(users.end(), learnedUsers.begin(), learnedUsers.end());
+		groups.insert(groups.end(), learnedGroups.begin(), learnedGroups.end());
+		// Leave some room for the accounts learned until the next rebuild; each account is added by ID and by name
+		auto rebuilt = AccountFilter::withCapacity(2 * (users.size() + groups.size()) * 5 / 4);
+		rebuilt.generation = filter.generation;
+		rebuilt.names = names;
+		for (const auto& [id, name] : users) {
+			rebuilt.add(Kind::UserID, id);
+			rebuilt.add(Kind::UserName, name);
+		}
+		for (const auto& [id, name] : groups) {
+			rebuilt.add(Kind::GroupID, id);
+			rebuilt.add(Kind::GroupName, name);
+		}
+		filter = std::move(rebuilt);
+		spdlog::info(
+				"Built filter of {} users and {} groups ({} bytes)", users.size(), groups.size(), filter.bits.size() * 8
+		);
+		publish();
+	}
+
+	void learn(Kind idKind, Kind nameKind, Accounts& learned, unsigned id, std::string_view name) {
+		std::lock_guard lock(mutex);
+		if (rebuilding)
+			learned.emplace_back(id, name);
+		bool changed = filter.add(idKind, id);
+		changed = filter.add(nameKind, name) || changed;
+		if (changed)
+			publish();
+	}
+
+public:
+	FilterPublisher(const gitlab::GitLab& gitlab, const Config& config)
+			: gitlab(gitlab), interval(config.filter.refreshInterval), names(config.filter.names),
+			  worker(interval, [this](std::stop_token stop) { rebuild(stop); }) {}
+
+	void learnUser(gitlab::UserID id, std::string_view username) {
+		learn(Kind::UserID, Kind::UserName, learnedUsers, id, username);
+	}
+	void learnGroup(gitlab::GroupID id, std::string_view name) {
+		learn(Kind::GroupID, Kind::GroupName, learnedGroups, id, name);
+	}
+};
+
+/**
+ * @brief Fetches the members of the groups configured in [warmup] on a thread of its own after the daemon started (and
+ * every refresh interval), such that the first logins are served from the cache. The caches are only ever touched by
+ * the event loop, which takes the fetched users from here (see GitLabDaemonImpl::warmUp).
+ */
+class CacheWarmer final {
+public:
+	struct Warmed {
+		gitlab::User user;
+		std::chrono::steady_clock::time_point fetched; /**< When the request for the user was sent. **/
+	};
+
+private:
+	const gitlab::GitLab& gitlab;
+	std::vector<std::string> groups;
+	std::chrono::seconds interval;
+	size_t limit; /**< More members than fit into the user cache would only be rejected by it. **/
+
+	std::mutex mutex;
+	std::vector<Warmed> fetched; /**< The users that were fetched but not taken yet. **/
+	bool done = false;
+	PeriodicWorker worker;
+
+	void warm(std::stop_token stop) {
+		// In the order of the configured groups, such that the members of the first groups are preferred
+		std::vector<gitlab::UserID> members;
+		std::set<gitlab::UserID> seen;
+		for (const auto& name : groups) {
+			if (members.size() >= limit)
+				break;
+			gitlab::Group group;
+			Error err = gitlab.fetchGroupByName(name, group);
+			if (err == Error::Ok) {
+				err = gitlab.forEachMember(group.id, [&](const gitlab::User& user) {
+					if (seen.insert(user.id).second)
+						members.push_back(user.id);
+					return members.size() < limit && !stop.stop_requested();
+				});
+			}
+			if (err != Error::Ok)
+				spdlog::error("Failed to fetch the members of {} with error {}", name, static_cast<unsigned>(err));
+		}
+		spdlog::info("Warming up the caches with {} members of {} groups", members.size(), groups.size());
+		size_t warmed = 0;
+		for (auto id : members) {
+			if (stop.stop_requested())
+				return;
+			// The user's groups come with them and are cached alongside (see GitLabDaemonImpl::cacheUser)
+			Warmed entry{.fetched = std::chrono::steady_clock::now()};
+			if (gitlab.fetchUserWithGroupsByID(id, entry.user) != Error::Ok)
+				continue;
+			std::lock_guard lock(mutex);
+			fetched.push_back(std::move(entry));
+			++warmed;
+		}
+		spdlog::info("Fetched {} of {} members to warm up the caches", warmed, members.size());
+	}
+
+public:
+	CacheWarmer(const gitlab::GitLab& gitlab, const Config& config)
+			: gitlab(gitlab), groups(config.warmup.groups), interval(config.warmup.refreshInterval),
+			  limit(config.nss.userCachesize), worker(interval, [this](std::stop_token stop) {
+				  warm(stop);
+				  std::lock_guard lock(mutex);
+				  done = interval.count() == 0;
+			  }) {}
+
+	/**
+	 * @brief Takes the users that were fetched since the last call.
+	 * @returns false once all users were fetched and taken.
+	 */
+	bool take(std::vector<Warmed>& users) {
+		std::lock_guard lock(mutex);
+		users = std::move(fetched);
+		fetched.clear();
+		return !done || !users.empty();
+	}
+};
 
 class GitLabDaemonImpl final : public GitLabDaemon::Server {
 private:
 	Config config;
 	gitlab::GitLab gitlab;
+	recording::Writer& recorder;
 
-	Cache<std::string, gitlab::User> usercache;
-	Cache<std::string, gitlab::Group> groupcache;
+	StringInterner interner;
+	std::map<gitlab::GroupID, std::string_view> groupNames;
+	Cache<std::string, CachedUser> usercache;
+	Cache<std::string, CachedGroup> groupcache;
+	Cache<std::string, PasswdEntry> passwdcache;
+	Cache<std::string, GroupEntry> grentcache;
+	Cache<std::string, std::vector<gid_t>> gidcache;
+	Cache<std::string, KeysEntry> keycache;
+	std::map<gitlab::UserID, KeysEntry> prefetchedKeys; /**< Keys fetched ahead of time, each served at most once. **/
 	std::map<gitlab::GroupID, gid_t> groupMap;
+	std::unique_ptr<FilterPublisher> filter;
+	std::unique_ptr<CacheWarmer> warmer;
+	/** When users were last invalidated, such that users that were warmed up before are not cached again. **/
+	std::map<gitlab::UserID, std::chrono::steady_clock::time_point> invalidated;
+	/** The peer whose request is handled right now (see CallerScope). **/
+	const ucred* caller = nullptr;
+	/** The UIDs of the users whose home directory was found or created; checked again once they are invalidated. **/
+	std::unordered_set<uid_t> homedirs;
 
 	template <typename V>
 	Cache<std::string, V>& getcache();
 
 	template <typename T>
 	bool findInCache(const std::string& cacheId, T& value) {
+		Trace::Timer timer("cache", cacheId);
 		auto& cache = getcache<T>();
-		if (cache.check(cacheId)) {
+		if (const T* val = cache.find(cacheId)) {
+			timer.annotate(" -> hit");
 			spdlog::info("Found in cache");
-			if (const T* val = &cache.fetch(cacheId)) {
-				value = *val;
-				return true;
-			} else {
-				spdlog::error("Type error (this should not happen)");
-			}
-		} else {
-			spdlog::info("Cachemiss");
+			value = *val;
+			return true;
 		}
+		spdlog::info("Cachemiss");
+		timer.annotate(" -> miss");
 		return false;
 	}
 
@@ -106,68 +464,522 @@ private:
 		return ret;
 	}
 
-	void populateUserDTO(User::Builder& dto, gitlab::User user) const;
+	CachedUser compact(const gitlab::User& user);
+	CachedGroup compact(const gitlab::Group& group);
+	std::string_view groupName(gitlab::GroupID id) const;
+
+	Error resolveUserByID(gitlab::UserID id, CachedUser& user);
+	Error resolveUserByName(const std::string& name, CachedUser& user);
+	void cacheUser(const CachedUser& user);
+	void stashKeys(gitlab::UserID id, const std::vector<std::string>& keys);
+	bool takePrefetchedKeys(gitlab::UserID id, KeysEntry& entry);
+	Error fetchKeys(gitlab::UserID id, std::vector<std::string>& keys);
+	Error resolveGroupByID(gitlab::GroupID id, CachedGroup& group);
+	Error resolveGroupByName(const std::string& name, CachedGroup& group);
+	void cacheGroup(const CachedGroup& group);
+	/** Records what was learned from GitLab for the replay (see recording::LearnedFlag). **/
+	void recordLearned(recording::Method method, const std::vector<std::string>& fields);
+
+	gid_t hostGroupID(gitlab::GroupID id) const;
+	size_t primaryGroupIndex(const CachedUser& user) const;
+	gid_t primaryGroupID(const CachedUser& user) const;
+	std::vector<gid_t> renderGroupIDs(const CachedUser& user) const;
+	void ensureHomedir(const PasswdEntry& entry);
+	PasswdEntry renderPasswd(const CachedUser& user) const;
+	GroupEntry renderGroup(const CachedGroup& group) const;
+
+	void populateUserDTO(User::Builder& dto, const CachedUser& user) const;
+	static void populatePasswdDTO(PasswdRecord::Builder& dto, const PasswdEntry& entry);
+	static void populateGroupDTO(GroupRecord::Builder& dto, const GroupEntry& entry);
 
 public:
-	GitLabDaemonImpl(Config config)
-			: config(config), gitlab(this->config), usercache{this->config.nss.userCachesize},
-			  groupcache{this->config.nss.groupCachesize}, groupMap(resolveGroupMap()) {}
+	/**
+	 * @brief Makes the peer of a request known to the handlers while they handle it (e.g., to decide whether the
+	 * request may create home directories).
+	 */
+	class CallerScope final {
+	private:
+		GitLabDaemonImpl& impl;
+		const ucred* previous;
+
+	public:
+		CallerScope(GitLabDaemonImpl& impl, const ucred& peer) noexcept : impl(impl), previous(impl.caller) {
+			impl.caller = &peer;
+		}
+		~CallerScope() { impl.caller = previous; }
+		CallerScope(const CallerScope&) = delete;
+		CallerScope& operator=(const CallerScope&) = delete;
+	};
+
+	GitLabDaemonImpl(Config config, recording::Writer& recorder)
+			: config(config), gitlab(this->config), recorder(recorder), usercache{userCacheOptions(this->config)},
+			  groupcache{groupCacheOptions(this->config)}, passwdcache{userCacheOptions(this->config)},
+			  grentcache{groupCacheOptions(this->config)}, gidcache{userCacheOptions(this->config)},
+			  keycache{userCacheOptions(this->config)}, groupMap(resolveGroupMap()) {
+		if (this->config.filter.enabled)
+			filter = std::make_unique<FilterPublisher>(gitlab, this->config);
+		if (!this->config.warmup.groups.empty())
+			warmer = std::make_unique<CacheWarmer>(gitlab, this->config);
+	}
+
+	void invalidateUser(gitlab::UserID id, std::string username = "");
+	/** Adds an account that may be missing from the published filter (e.g., because it was just created). **/
+	void learnUser(gitlab::UserID id, std::string_view username);
+	void learnGroup(gitlab::GroupID id, std::string_view name);
+	/**
+	 * @param newName The group's name after it was renamed; empty if it was destroyed.
+	 */
+	void invalidateGroup(gitlab::GroupID id, const std::string& newName = "");
+	void invalidateKeys(const std::string& username);
+	/**
+	 * @brief Caches the users that were fetched in the background to warm up the caches (see CacheWarmer).
+	 * @returns false once there is nothing left to warm up.
+	 */
+	bool warmUp();
+
+	void logStats() const;
 
 	virtual ::kj::Promise<void> getUserByID(GetUserByIDContext context) override;
 	virtual ::kj::Promise<void> getUserByName(GetUserByNameContext context) override;
 	virtual ::kj::Promise<void> getSSHKeys(GetSSHKeysContext context) override;
 	virtual ::kj::Promise<void> getGroupByID(GetGroupByIDContext context) override;
 	virtual ::kj::Promise<void> getGroupByName(GetGroupByNameContext context) override;
+	virtual ::kj::Promise<void> getPasswdByID(GetPasswdByIDContext context) override;
+	virtual ::kj::Promise<void> getPasswdByName(GetPasswdByNameContext context) override;
+	virtual ::kj::Promise<void> getGroupRecordByID(GetGroupRecordByIDContext context) override;
+	virtual ::kj::Promise<void> getGroupRecordByName(GetGroupRecordByNameContext context) override;
+	virtual ::kj::Promise<void> getGroupIDsByName(GetGroupIDsByNameContext context) override;
 };
 
 template <>
-constexpr Cache<std::string, gitlab::User>& GitLabDaemonImpl::getcache<gitlab::User>() {
+constexpr Cache<std::string, CachedUser>& GitLabDaemonImpl::getcache<CachedUser>() {
 	return usercache;
 }
 template <>
-constexpr Cache<std::string, gitlab::Group>& GitLabDaemonImpl::getcache<gitlab::Group>() {
+constexpr Cache<std::string, CachedGroup>& GitLabDaemonImpl::getcache<CachedGroup>() {
 	return groupcache;
 }
+template <>
+constexpr Cache<std::string, PasswdEntry>& GitLabDaemonImpl::getcache<PasswdEntry>() {
+	return passwdcache;
+}
+template <>
+constexpr Cache<std::string, GroupEntry>& GitLabDaemonImpl::getcache<GroupEntry>() {
+	return grentcache;
+}
+template <>
+constexpr Cache<std::string, std::vector<gid_t>>& GitLabDaemonImpl::getcache<std::vector<gid_t>>() {
+	return gidcache;
+}
+template <>
+constexpr Cache<std::string, KeysEntry>& GitLabDaemonImpl::getcache<KeysEntry>() {
+	return keycache;
+}
 
-void GitLabDaemonImpl::populateUserDTO(User::Builder& dto, gitlab::User user) const {
-	dto.setId(user.id);
-	dto.setName(user.name);
-	dto.setUsername(user.username);
-	dto.setState(user.state);
-	// Move primary group of the user to the front
+void GitLabDaemonImpl::invalidateUser(gitlab::UserID id, std::string username) {
+	spdlog::info("Invalidating user {} ({})", id, username);
+	if (warmer)
+		invalidated[id] = std::chrono::steady_clock::now();
+	if (username.empty()) {
+		if (const CachedUser* user = usercache.peek(std::format("getUserByID({})", id)))
+			username = user->username;
+	}
+	usercache.erase(std::format("getUserByID({})", id));
+	passwdcache.erase(std::format("getPasswdByID({})", id));
+	keycache.erase(std::format("getSSHKeys({})", id));
+	prefetchedKeys.erase(id);
+	homedirs.erase(id + config.nss.uidOffset);
+	if (!username.empty()) {
+		usercache.erase(std::format("getUserByName({})", username));
+		passwdcache.erase(std::format("getPasswdByName({})", username));
+		gidcache.erase(std::format("getGroupIDsByName({})", username));
+	}
+}
+
+void GitLabDaemonImpl::invalidateGroup(gitlab::GroupID id, const std::string& newName) {
+	spdlog::info("Invalidating group {}", id);
+	// groupNames knows the name of every group of a cached user, whether or not the group itself is still cached
+	std::string oldName{groupName(id)};
+	if (!oldName.empty()) {
+		groupcache.erase(std::format("getGroupByName({})", oldName));
+		grentcache.erase(std::format("getGroupRecordByName({})", oldName));
+	}
+	if (!newName.empty()) {
+		groupcache.erase(std::format("getGroupByName({})", newName));
+		grentcache.erase(std::format("getGroupRecordByName({})", newName));
+		groupNames[id] = interner.intern(newName);
+	}
+	const auto& primary = config.nss.primaryGroup;
+	if (primary && oldName != newName && (oldName == *primary || newName == *primary)) {
+		// The primary GID of the group's members changes, and we can't enumerate the members here
+		spdlog::info("A group was renamed to or from the primary group; dropping all cached users");
+		usercache.clear();
+		passwdcache.clear();
+		gidcache.clear();
+	}
+	groupcache.erase(std::format("getGroupByID({})", id));
+	grentcache.erase(std::format("getGroupRecordByID({})", id));
+}
+
+void GitLabDaemonImpl::invalidateKeys(const std::string& username) {
+	spdlog::info("Invalidating SSH keys of {}", username);
+	if (const CachedUser* user = usercache.peek(std::format("getUserByName({})", username))) {
+		keycache.erase(std::format("getSSHKeys({})", user->id));
+		prefetchedKeys.erase(user->id);
+	} else {
+		// Keys are cached by user ID; without knowing it, drop them all rather than serve a revoked key
+		keycache.clear();
+		prefetchedKeys.clear();
+	}
+}
+
+void GitLabDaemonImpl::learnUser(gitlab::UserID id, std::string_view username) {
+	if (filter)
+		filter->learnUser(id, username);
+}
+
+void GitLabDaemonImpl::learnGroup(gitlab::GroupID id, std::string_view name) {
+	if (filter)
+		filter->learnGroup(id, name);
+}
+
+bool GitLabDaemonImpl::warmUp() {
+	std::vector<CacheWarmer::Warmed> users;
+	if (!warmer || !warmer->take(users))
+		return false;
+	for (const auto& [user, fetched] : users) {
+		// Drop users that were invalidated after they were fetched, and never replace a user that is cached already
+		if (auto it = invalidated.find(user.id); it != invalidated.end() && it->second >= fetched)
+			continue;
+		if (usercache.contains(std::format("getUserByID({})", user.id)))
+			continue;
+		cacheUser(compact(user));
+	}
+	// Users are fetched one after the other; older invalidations can't affect the users fetched from now on
+	if (!users.empty()) {
+		auto latest = users.back().fetched;
+		std::erase_if(invalidated, [latest](const auto& entry) { return entry.second < latest; });
+	}
+	return true;
+}
+
+void GitLabDaemonImpl::logStats() const {
+	auto log = [](const char* name, const auto& cache) {
+		auto stats = cache.stats();
+		spdlog::info(
+				"{}: {} entries (~{} bytes, ~{} per entry), {} hits, {} misses, {} rejected by admission, {} evicted",
+				name, stats.entries, stats.bytes, stats.bytesPerEntry, stats.hits, stats.misses, stats.rejected,
+				stats.evicted
+		);
+	};
+	log("usercache", usercache);
+	log("groupcache", groupcache);
+	log("passwdcache", passwdcache);
+	log("grentcache", grentcache);
+	log("gidcache", gidcache);
+	log("keycache", keycache);
+	spdlog::info(
+			"interned strings: {} ({} bytes); known groups: {}", interner.size(), interner.bytes(), groupNames.size()
+	);
+}
+
+CachedUser GitLabDaemonImpl::compact(const gitlab::User& user) {
+	CachedUser ret{
+			.id = user.id,
+			.username = interner.intern(user.username),
+			.state = interner.intern(user.state),
+			.name = user.name,
+	};
+	ret.groups.reserve(user.groups.size());
+	for (const auto& group : user.groups)
+		ret.groups.push_back(compact(group).id);
+	return ret;
+}
+
+CachedGroup GitLabDaemonImpl::compact(const gitlab::Group& group) {
+	auto name = interner.intern(group.name);
+	groupNames[group.id] = name;
+	return CachedGroup{.id = group.id, .name = name};
+}
+
+std::string_view GitLabDaemonImpl::groupName(gitlab::GroupID id) const {
+	auto it = groupNames.find(id);
+	return it != groupNames.end() ? it->second : std::string_view{""};
+}
+
+Error GitLabDaemonImpl::resolveUserByID(gitlab::UserID id, CachedUser& user) {
+	if (findInCache(std::format("getUserByID({})", id), user))
+		return Error::Ok;
+	gitlab::User fetched;
+	Error err;
+	if ((err = gitlab.fetchUserWithGroupsByID(id, fetched)) == Error::Ok) {
+		user = compact(fetched);
+		cacheUser(user);
+	}
+	return err;
+}
+
+Error GitLabDaemonImpl::resolveUserByName(const std::string& name, CachedUser& user) {
+	if (findInCache(std::format("getUserByName({})", name), user))
+		return Error::Ok;
+	gitlab::User fetched;
+	Error err;
+	// Users are looked up by name when they log in, e.g., by sshd right before it asks for their keys
+	std::expected<std::vector<std::string>, Error> keys;
+	if ((err = gitlab.fetchUserWithGroupsByUsername(name, fetched, config.nss.prefetch ? &keys : nullptr)) ==
+		Error::Ok) {
+		user = compact(fetched);
+		cacheUser(user);
+		if (config.nss.prefetch && keys.has_value())
+			stashKeys(user.id, keys.value());
+	}
+	return err;
+}
+
+void GitLabDaemonImpl::cacheUser(const CachedUser& user) {
+	usercache.insert_or_assign(
+			std::format("getUserByID({})", user.id), std::format("getUserByName({})", user.username), user
+	);
+	learnUser(user.id, user.username);
+	if (recorder.isOpen()) {
+		std::vector<std::string> fields{std::to_string(user.id), std::string{user.username}};
+		for (auto id : user.groups) {
+			fields.push_back(std::to_string(id));
+			fields.emplace_back(groupName(id));
+		}
+		recordLearned(recording::Method::GetUserByID, fields);
+	}
+	// The memberships name the user's groups, which are usually looked up right after (e.g., by id or ls -l)
+	for (auto id : user.groups)
+		if (!groupcache.contains(std::format("getGroupByID({})", id)))
+			cacheGroup(CachedGroup{.id = id, .name = groupName(id)});
+}
+
+/**
+ * @brief Joins the keys into the newline separated form that getSSHKeys returns.
+ */
+static KeysEntry joinKeys(const std::vector<std::string>& keys) {
+	// When std::ranges::to is finally implemented by GCC:
+	// std::string joined = keys | std::views::join | std::ranges::to<std::string>();
+	KeysEntry entry{.fetched = std::chrono::steady_clock::now()};
+	for (auto&& key : keys)
+		entry.keys += key + "\n";
+	return entry;
+}
+
+void GitLabDaemonImpl::stashKeys(gitlab::UserID id, const std::vector<std::string>& keys) {
+	if (config.nss.keysTTL > 0) {
+		keycache.insert_or_assign(std::format("getSSHKeys({})", id), joinKeys(keys));
+		return;
+	}
+	// Without a TTL for keys, prefetched keys are only kept until they are asked for right after
+	auto now = std::chrono::steady_clock::now();
+	std::erase_if(prefetchedKeys, [now](const auto& entry) {
+		return now - entry.second.fetched >= PrefetchedKeysLifetime;
+	});
+	prefetchedKeys.insert_or_assign(id, joinKeys(keys));
+}
+
+bool GitLabDaemonImpl::takePrefetchedKeys(gitlab::UserID id, KeysEntry& entry) {
+	auto it = prefetchedKeys.find(id);
+	if (it == prefetchedKeys.end())
+		return false;
+	bool fresh = std::chrono::steady_clock::now() - it->second.fetched < PrefetchedKeysLifetime;
+	if (fresh)
+		entry = std::move(it->second);
+	prefetchedKeys.erase(it);
+	return fresh;
+}
+
+Error GitLabDaemonImpl::fetchKeys(gitlab::UserID id, std::vector<std::string>& keys) {
+	if (!config.nss.prefetch || usercache.contains(std::format("getUserByID({})", id)))
+		return gitlab.fetchAuthorizedKeys(id, keys);
+	// The user is most likely looked up next (e.g., when sshd opens the session); fetch them alongside the keys
+	gitlab::User fetched;
+	std::expected<std::vector<std::string>, Error> fetchedKeys;
+	if (gitlab.fetchUserWithGroupsByID(id, fetched, &fetchedKeys) == Error::Ok)
+		cacheUser(compact(fetched));
+	if (!fetchedKeys.has_value())
+		return fetchedKeys.error();
+	keys = std::move(fetchedKeys.value());
+	return Error::Ok;
+}
+
+Error GitLabDaemonImpl::resolveGroupByID(gitlab::GroupID id, CachedGroup& group) {
+	if (findInCache(std::format("getGroupByID({})", id), group))
+		return Error::Ok;
+	gitlab::Group fetched;
+	Error err;
+	if ((err = gitlab.fetchGroupByID(id, fetched)) == Error::Ok) {
+		group = compact(fetched);
+		cacheGroup(group);
+		recordLearned(recording::Method::GetGroupByID, {std::to_string(group.id), std::string{group.name}});
+	}
+	return err;
+}
+
+Error GitLabDaemonImpl::resolveGroupByName(const std::string& name, CachedGroup& group) {
+	if (findInCache(std::format("getGroupByName({})", name), group))
+		return Error::Ok;
+	gitlab::Group fetched;
+	Error err;
+	if ((err = gitlab.fetchGroupByName(name, fetched)) == Error::Ok) {
+		group = compact(fetched);
+		cacheGroup(group);
+		recordLearned(recording::Method::GetGroupByID, {std::to_string(group.id), std::string{group.name}});
+	}
+	return err;
+}
+
+void GitLabDaemonImpl::cacheGroup(const CachedGroup& group) {
+	groupcache.insert_or_assign(
+			std::format("getGroupByID({})", group.id), std::format("getGroupByName({})", group.name), group
+	);
+	learnGroup(group.id, group.name);
+}
+
+void GitLabDaemonImpl::recordLearned(recording::Method method, const std::vector<std::string>& fields) {
+	if (!recorder.isOpen())
+		return;
+	recorder.write(recording::Record{
+			.time = std::chrono::duration_cast<std::chrono::microseconds>(
+					std::chrono::system_clock::now().time_since_epoch()
+			),
+			.method = method,
+			.hit = false,
+			.found = true,
+			.key = recording::joinFields(fields),
+			.learned = true
+	});
+}
+
+gid_t GitLabDaemonImpl::hostGroupID(gitlab::GroupID id) const {
+	if (auto mapped = groupMap.find(id); mapped != groupMap.end())
+		return mapped->second;
+	return id + config.nss.gidOffset;
+}
+
+size_t GitLabDaemonImpl::primaryGroupIndex(const CachedUser& user) const {
 	auto it = std::find_if(std::begin(user.groups), std::end(user.groups), [this](const auto& group) {
-		return group.name == config.nss.primaryGroup;
+		return groupName(group) == config.nss.primaryGroup;
 	});
-	if (it != std::end(user.groups))
-		std::swap(*it, user.groups[0]);
-	//
+	return (it != std::end(user.groups)) ? std::distance(std::begin(user.groups), it) : 0;
+}
+
+gid_t GitLabDaemonImpl::primaryGroupID(const CachedUser& user) const {
+	if (user.groups.empty())
+		return 65534; /*nogroup*/
+	return hostGroupID(user.groups[primaryGroupIndex(user)]);
+}
+
+std::vector<gid_t> GitLabDaemonImpl::renderGroupIDs(const CachedUser& user) const {
+	std::vector<gid_t> gids;
+	if (user.groups.empty())
+		return gids;
+	gids.reserve(user.groups.size());
+	auto primary = primaryGroupIndex(user);
+	gids.push_back(hostGroupID(user.groups[primary]));
+	for (size_t i = 0; i < user.groups.size(); ++i)
+		if (i != primary)
+			gids.push_back(hostGroupID(user.groups[i]));
+	return gids;
+}
+
+PasswdEntry GitLabDaemonImpl::renderPasswd(const CachedUser& user) const {
+	PasswdEntry entry{.uid = user.id + config.nss.uidOffset, .gid = primaryGroupID(user)};
+	entry.name = appendString(entry.data, user.username);
+	// user can't login with PW: https://www.man7.org/linux/man-pages/man5/shadow.5.html
+	entry.passwd = appendString(entry.data, "*");
+	entry.gecos = appendString(entry.data, user.name);
+	entry.dir = appendString(entry.data, (config.nss.homesRoot / user.username).string());
+	entry.shell = appendString(entry.data, config.nss.shell);
+	return entry;
+}
+
+void GitLabDaemonImpl::ensureHomedir(const PasswdEntry& entry) {
+	// Only lookups by root (e.g., sshd or login) create home directories, as they did when the NSS module created them
+	// in the calling process. Otherwise, any user could have the daemon create home directories for arbitrary users.
+	if (!config.nss.createHomedirs || caller == nullptr || caller->uid != 0 || homedirs.contains(entry.uid))
+		return;
+	// Each home directory is only checked once (homes_root may well be on NFS); forget them all once there are too many
+	if (homedirs.size() >= config.nss.userCachesize)
+		homedirs.clear();
+	const char* homedir = entry.data.c_str() + entry.dir;
+	std::error_code ec;
+	if (fs::exists(homedir, ec)) {
+		homedirs.insert(entry.uid);
+		return;
+	}
+	spdlog::info("Creating home directory {}", homedir);
+	if (!fs::create_directories(homedir, ec) && ec) {
+		spdlog::error("Failed to create home directory {}: {}", homedir, ec.message());
+		return;
+	}
+	homedirs.insert(entry.uid);
+	if (chown(homedir, entry.uid, entry.gid) != 0)
+		spdlog::warn("Failed to change owner of {} with errno {}", homedir, errno);
+	if (chmod(homedir, static_cast<mode_t>(config.nss.homePerms)) != 0)
+		spdlog::warn("Failed to change permissions of {} with errno {}", homedir, errno);
+}
+
+GroupEntry GitLabDaemonImpl::renderGroup(const CachedGroup& group) const {
+	GroupEntry entry{.gid = group.id + config.nss.gidOffset};
+	entry.name = appendString(entry.data, config.nss.groupPrefix + std::string{group.name});
+	entry.passwd = appendString(entry.data, "*");
+	return entry;
+}
+
+void GitLabDaemonImpl::populateUserDTO(User::Builder& dto, const CachedUser& user) const {
+	Trace::Timer timer("serialize");
+	dto.setId(user.id);
+	dto.setName(user.name);
+	dto.setUsername(toText(user.username));
+	dto.setState(toText(user.state));
+	// The primary group of the user goes to the front
+	auto primary = user.groups.empty() ? 0 : primaryGroupIndex(user);
 	auto groups = dto.initGroups(user.groups.size());
-	for (auto i = 0; i < user.groups.size(); ++i) {
-		if (decltype(groupMap)::const_iterator it; (it = groupMap.find(user.groups[i].id)) != groupMap.end()) {
+	for (size_t i = 0; i < user.groups.size(); ++i) {
+		auto id = user.groups[i == 0 ? primary : (i == primary ? 0 : i)];
+		if (decltype(groupMap)::const_iterator it; (it = groupMap.find(id)) != groupMap.end()) {
 			// Group mapped to host group
 			groups[i].setId(it->second);
 			groups[i].setName("");
 			groups[i].setLocal(true);
 		} else {
 			// GitLab group
-			groups[i].setId(user.groups[i].id);
-			groups[i].setName(user.groups[i].name);
+			groups[i].setId(id);
+			groups[i].setName(toText(groupName(id)));
 			groups[i].setLocal(false);
 		}
 	}
 }
 
+void GitLabDaemonImpl::populatePasswdDTO(PasswdRecord::Builder& dto, const PasswdEntry& entry) {
+	Trace::Timer timer("serialize");
+	dto.setUid(entry.uid);
+	dto.setGid(entry.gid);
+	dto.setData(kj::arrayPtr(reinterpret_cast<const kj::byte*>(entry.data.data()), entry.data.size()));
+	dto.setName(entry.name);
+	dto.setPasswd(entry.passwd);
+	dto.setGecos(entry.gecos);
+	dto.setDir(entry.dir);
+	dto.setShell(entry.shell);
+}
+
+void GitLabDaemonImpl::populateGroupDTO(GroupRecord::Builder& dto, const GroupEntry& entry) {
+	Trace::Timer timer("serialize");
+	dto.setGid(entry.gid);
+	dto.setData(kj::arrayPtr(reinterpret_cast<const kj::byte*>(entry.data.data()), entry.data.size()));
+	dto.setName(entry.name);
+	dto.setPasswd(entry.passwd);
+}
+
 ::kj::Promise<void> GitLabDaemonImpl::getUserByID(GetUserByIDContext context) {
-	auto& cache = getcache<gitlab::User>();
 	spdlog::info("getUserByID({})", context.getParams().getId());
-	auto cacheId = std::format("getUserByID({})", context.getParams().getId());
-	gitlab::User user;
-	Error err = Error::Ok;
-	if (findInCache(cacheId, user) || ((err = gitlab.fetchUserByID(context.getParams().getId(), user)) == Error::Ok &&
-									   (err = gitlab.fetchGroups(user)) == Error::Ok)) {
+	CachedUser user;
+	Error err;
+	if ((err = resolveUserByID(context.getParams().getId(), user)) == Error::Ok) {
 		spdlog::debug("Found");
-		cache.insert_or_assign(cacheId, user);
-		cache.insert_or_assign(std::format("getUserByName({})", user.name), user);
 		auto output = context.getResults().initUser();
 		populateUserDTO(output, user);
 	}
@@ -175,17 +987,11 @@ void GitLabDaemonImpl::populateUserDTO(User::Builder& dto, gitlab::User user) co
 	return kj::READY_NOW;
 }
 ::kj::Promise<void> GitLabDaemonImpl::getUserByName(GetUserByNameContext context) {
-	auto& cache = getcache<gitlab::User>();
 	spdlog::info("getUserByName({})", context.getParams().getName().cStr());
-	auto cacheId = std::format("getUserByName({})", context.getParams().getName().cStr());
-	gitlab::User user;
-	Error err = Error::Ok;
-	if (findInCache(cacheId, user) ||
-		((err = gitlab.fetchUserByUsername(context.getParams().getName().cStr(), user)) == Error::Ok &&
-		 (err = gitlab.fetchGroups(user)) == Error::Ok)) {
+	CachedUser user;
+	Error err;
+	if ((err = resolveUserByName(context.getParams().getName().cStr(), user)) == Error::Ok) {
 		spdlog::debug("Found");
-		cache.insert_or_assign(cacheId, user);
-		cache.insert_or_assign(std::format("getUserByID({})", user.id), user);
 		auto output = context.getResults().initUser();
 		populateUserDTO(output, user);
 	}
@@ -194,59 +1000,484 @@ void GitLabDaemonImpl::populateUserDTO(User::Builder& dto, gitlab::User user) co
 }
 
 ::kj::Promise<void> GitLabDaemonImpl::getSSHKeys(GetSSHKeysContext context) {
+	auto& cache = getcache<KeysEntry>();
 	spdlog::info("getSSHKeys({})", context.getParams().getId());
-	std::vector<std::string> keys;
-	Error err;
-	if ((err = gitlab.fetchAuthorizedKeys(context.getParams().getId(), keys)) == Error::Ok) {
+	auto cacheId = std::format("getSSHKeys({})", context.getParams().getId());
+	auto ttl = std::chrono::seconds{config.nss.keysTTL};
+	KeysEntry entry;
+	Error err = Error::Ok;
+	if (ttl.count() > 0 && findInCache(cacheId, entry) && std::chrono::steady_clock::now() - entry.fetched < ttl) {
 		spdlog::debug("Found");
-		// When std::ranges::to is finally implemented by GCC:
-		// std::string joined = keys | std::views::join | std::ranges::to<std::string>();
-		std::string joined;
-		for (auto&& key : keys)
-			joined += key + "\n";
-
-		context.getResults().setKeys(joined);
+		context.getResults().setKeys(entry.keys);
+	} else if (takePrefetchedKeys(context.getParams().getId(), entry)) {
+		spdlog::debug("Found prefetched");
+		context.getResults().setKeys(entry.keys);
+	} else if (std::vector<std::string> keys; (err = fetchKeys(context.getParams().getId(), keys)) == Error::Ok) {
+		spdlog::debug("Found");
+		entry = joinKeys(keys);
+		if (ttl.count() > 0)
+			cache.insert_or_assign(cacheId, entry);
+		context.getResults().setKeys(entry.keys);
 	}
 	context.getResults().setErrcode(static_cast<uint32_t>(err));
 	return kj::READY_NOW;
 }
 
 ::kj::Promise<void> GitLabDaemonImpl::getGroupByID(GetGroupByIDContext context) {
-	auto& cache = getcache<gitlab::Group>();
 	spdlog::info("getGroupByID({})", context.getParams().getId());
-	auto cacheId = std::format("getGroupByID({})", context.getParams().getId());
-	gitlab::Group group;
-	Error err = Error::Ok;
-	if (findInCache(cacheId, group) || (err = gitlab.fetchGroupByID(context.getParams().getId(), group)) == Error::Ok) {
+	CachedGroup group;
+	Error err;
+	if ((err = resolveGroupByID(context.getParams().getId(), group)) == Error::Ok) {
 		spdlog::debug("Found");
-		cache.insert_or_assign(std::format("getGroupByName({})", group.name), group);
-		cache.insert_or_assign(cacheId, group);
 		auto output = context.getResults().initGroup();
 		output.setId(group.id);
-		output.setName(group.name);
+		output.setName(toText(group.name));
 	}
 	context.getResults().setErrcode(static_cast<uint32_t>(err));
 	return kj::READY_NOW;
 }
 ::kj::Promise<void> GitLabDaemonImpl::getGroupByName(GetGroupByNameContext context) {
-	auto& cache = getcache<gitlab::Group>();
 	spdlog::info("getGroupByName({})", context.getParams().getName().cStr());
-	auto cacheId = std::format("getGroupByName({})", context.getParams().getName().cStr());
-	gitlab::Group group;
-	Error err = Error::Ok;
-	if (findInCache(cacheId, group) ||
-		(err = gitlab.fetchGroupByName(context.getParams().getName().cStr(), group)) == Error::Ok) {
+	CachedGroup group;
+	Error err;
+	if ((err = resolveGroupByName(context.getParams().getName().cStr(), group)) == Error::Ok) {
 		spdlog::debug("Found");
-		cache.insert_or_assign(cacheId, group);
-		cache.insert_or_assign(std::format("getGroupByID({})", group.id), group);
 		auto output = context.getResults().initGroup();
 		output.setId(group.id);
-		output.setName(group.name);
+		output.setName(toText(group.name));
+	}
+	context.getResults().setErrcode(static_cast<uint32_t>(err));
+	return kj::READY_NOW;
+}
+
+::kj::Promise<void> GitLabDaemonImpl::getPasswdByID(GetPasswdByIDContext context) {
+	auto& cache = getcache<PasswdEntry>();
+	spdlog::info("getPasswdByID({})", context.getParams().getId());
+	auto cacheId = std::format("getPasswdByID({})", context.getParams().getId());
+	PasswdEntry entry;
+	Error err = Error::Ok;
+	if (CachedUser user; !findInCache(cacheId, entry) &&
+						   (err = resolveUserByID(context.getParams().getId(), user)) == Error::Ok) {
+		if (user.state != "active") {
+			spdlog::debug("User is not active (status: {})", user.state);
+			err = Error::NotFound;
+		} else {
+			entry = renderPasswd(user);
+			cache.insert_or_assign(cacheId, std::format("getPasswdByName({})", user.username), entry);
+		}
+	}
+	if (err == Error::Ok) {
+		spdlog::debug("Found");
+		ensureHomedir(entry);
+		auto output = context.getResults().initRecord();
+		populatePasswdDTO(output, entry);
+	}
+	context.getResults().setErrcode(static_cast<uint32_t>(err));
+	return kj::READY_NOW;
+}
+::kj::Promise<void> GitLabDaemonImpl::getPasswdByName(GetPasswdByNameContext context) {
+	auto& cache = getcache<PasswdEntry>();
+	spdlog::info("getPasswdByName({})", context.getParams().getName().cStr());
+	auto cacheId = std::format("getPasswdByName({})", context.getParams().getName().cStr());
+	PasswdEntry entry;
+	Error err = Error::Ok;
+	if (CachedUser user; !findInCache(cacheId, entry) &&
+						   (err = resolveUserByName(context.getParams().getName().cStr(), user)) == Error::Ok) {
+		if (user.state != "active") {
+			spdlog::debug("User is not active (status: {})", user.state);
+			err = Error::NotFound;
+		} else {
+			entry = renderPasswd(user);
+			cache.insert_or_assign(cacheId, std::format("getPasswdByID({})", user.id), entry);
+		}
+	}
+	if (err == Error::Ok) {
+		spdlog::debug("Found");
+		ensureHomedir(entry);
+		auto output = context.getResults().initRecord();
+		populatePasswdDTO(output, entry);
+	}
+	context.getResults().setErrcode(static_cast<uint32_t>(err));
+	return kj::READY_NOW;
+}
+
+::kj::Promise<void> GitLabDaemonImpl::getGroupRecordByID(GetGroupRecordByIDContext context) {
+	auto& cache = getcache<GroupEntry>();
+	spdlog::info("getGroupRecordByID({})", context.getParams().getId());
+	auto cacheId = std::format("getGroupRecordByID({})", context.getParams().getId());
+	GroupEntry entry;
+	Error err = Error::Ok;
+	if (CachedGroup group; !findInCache(cacheId, entry) &&
+							 (err = resolveGroupByID(context.getParams().getId(), group)) == Error::Ok) {
+		entry = renderGroup(group);
+		cache.insert_or_assign(cacheId, std::format("getGroupRecordByName({})", group.name), entry);
+	}
+	if (err == Error::Ok) {
+		spdlog::debug("Found");
+		auto output = context.getResults().initRecord();
+		populateGroupDTO(output, entry);
+	}
+	context.getResults().setErrcode(static_cast<uint32_t>(err));
+	return kj::READY_NOW;
+}
+::kj::Promise<void> GitLabDaemonImpl::getGroupRecordByName(GetGroupRecordByNameContext context) {
+	auto& cache = getcache<GroupEntry>();
+	spdlog::info("getGroupRecordByName({})", context.getParams().getName().cStr());
+	auto cacheId = std::format("getGroupRecordByName({})", context.getParams().getName().cStr());
+	GroupEntry entry;
+	Error err = Error::Ok;
+	if (CachedGroup group; !findInCache(cacheId, entry) &&
+							 (err = resolveGroupByName(context.getParams().getName().cStr(), group)) == Error::Ok) {
+		entry = renderGroup(group);
+		cache.insert_or_assign(cacheId, std::format("getGroupRecordByID({})", group.id), entry);
+	}
+	if (err == Error::Ok) {
+		spdlog::debug("Found");
+		auto output = context.getResults().initRecord();
+		populateGroupDTO(output, entry);
+	}
+	context.getResults().setErrcode(static_cast<uint32_t>(err));
+	return kj::READY_NOW;
+}
+
+::kj::Promise<void> GitLabDaemonImpl::getGroupIDsByName(GetGroupIDsByNameContext context) {
+	auto& cache = getcache<std::vector<gid_t>>();
+	spdlog::info("getGroupIDsByName({})", context.getParams().getName().cStr());
+	auto cacheId = std::format("getGroupIDsByName({})", context.getParams().getName().cStr());
+	std::vector<gid_t> gids;
+	Error err = Error::Ok;
+	if (CachedUser user; !findInCache(cacheId, gids) &&
+						   (err = resolveUserByName(context.getParams().getName().cStr(), user)) == Error::Ok) {
+		if (user.state != "active") {
+			spdlog::debug("User is not active (status: {})", user.state);
+			err = Error::NotFound;
+		} else {
+			gids = renderGroupIDs(user);
+			cache.insert_or_assign(cacheId, gids);
+		}
+	}
+	if (err == Error::Ok) {
+		spdlog::debug("Found");
+		auto output = context.getResults().initGids(gids.size());
+		for (size_t i = 0; i < gids.size(); ++i)
+			output.set(i, gids[i]);
 	}
 	context.getResults().setErrcode(static_cast<uint32_t>(err));
 	return kj::READY_NOW;
 }
 
+/**
+ * @brief Receives GitLab system hooks and drops the affected entries from the daemon's caches. See
+ * https://docs.gitlab.com/ee/administration/system_hooks.html for the payloads.
+ */
+class SystemHookService final : public kj::HttpService {
+private:
+	GitLabDaemonImpl& daemon;
+	const kj::HttpHeaderTable& headerTable;
+	kj::HttpHeaderId tokenHeader;
+	std::string secret;
+
+	bool verifyToken(kj::StringPtr token) const {
+		// Constant time comparison such that the secret can't be guessed by timing the responses
+		if (token.size() != secret.size())
+			return false;
+		unsigned char diff = 0;
+		for (size_t i = 0; i < secret.size(); ++i)
+			diff |= static_cast<unsigned char>(token[i] ^ secret[i]);
+		return diff == 0;
+	}
+
+	void handleEvent(const rapidjson::Document& json) {
+		auto getString = [&json](const char* key) -> std::string {
+			auto it = json.FindMember(key);
+			return (it != json.MemberEnd() && it->value.IsString()) ? it->value.GetString() : "";
+		};
+		auto getID = [&json](const char* key) -> std::optional<unsigned> {
+			auto it = json.FindMember(key);
+			return (it != json.MemberEnd() && it->value.IsUint()) ? std::optional{it->value.GetUint()} : std::nullopt;
+		};
+		auto event = getString("event_name");
+		spdlog::info("Received system hook {}", event);
+		if (event == "user_create" || event == "user_destroy") {
+			if (auto id = getID("user_id")) {
+				daemon.invalidateUser(*id, getString("username"));
+				if (event == "user_create")
+					daemon.learnUser(*id, getString("username"));
+			}
+		} else if (event == "user_rename") {
+			if (auto id = getID("user_id")) {
+				daemon.invalidateUser(*id, getString("old_username"));
+				daemon.invalidateUser(*id, getString("username"));
+				daemon.learnUser(*id, getString("username"));
+			}
+		} else if (event == "user_add_to_group" || event == "user_remove_from_group" ||
+				   event == "user_update_for_group") {
+			if (auto id = getID("user_id"))
+				daemon.invalidateUser(*id, getString("user_username"));
+		} else if (event == "key_create" || event == "key_destroy") {
+			daemon.invalidateKeys(getString("username"));
+		} else if (event == "group_create") {
+			if (auto id = getID("group_id"))
+				daemon.learnGroup(*id, getString("name"));
+		} else if (event == "group_rename" || event == "group_destroy") {
+			if (auto id = getID("group_id")) {
+				if (event == "group_rename") {
+					daemon.invalidateGroup(*id, getString("name"));
+					daemon.learnGroup(*id, getString("name"));
+				} else {
+					daemon.invalidateGroup(*id);
+				}
+			}
+		} else {
+			spdlog::debug("Ignoring system hook {}", event);
+		}
+	}
+
+public:
+	SystemHookService(
+			GitLabDaemonImpl& daemon, const kj::HttpHeaderTable& headerTable, kj::HttpHeaderId tokenHeader,
+			std::string secret
+	)
+			: daemon(daemon), headerTable(headerTable), tokenHeader(tokenHeader), secret(std::move(secret)) {}
+
+	kj::Promise<void> request(
+			kj::HttpMethod method, kj::StringPtr url, const kj::HttpHeaders& headers,
+			kj::AsyncInputStream& requestBody, Response& response
+	) override {
+		if (method != kj::HttpMethod::POST)
+			return response.sendError(405, "Method Not Allowed", headerTable);
+		bool authorized = false;
+		auto token = headers.get(tokenHeader);
+		KJ_IF_MAYBE (value, token) {
+			authorized = verifyToken(*value);
+		}
+		if (!authorized) {
+			spdlog::warn("Rejected system hook with missing or invalid token");
+			return response.sendError(401, "Unauthorized", headerTable);
+		}
+		return requestBody.readAllText().then([this, &response](kj::String body) {
+			rapidjson::Document json;
+			json.Parse(body.cStr());
+			if (json.HasParseError() || !json.IsObject())
+				return response.sendError(400, "Bad Request", headerTable);
+			handleEvent(json);
+			kj::HttpHeaders responseHeaders(headerTable);
+			response.send(200, "OK", responseHeaders, uint64_t{0});
+			return kj::Promise<void>(kj::READY_NOW);
+		});
+	}
+};
+
+static kj::Promise<void> listenSystemHooks(kj::AsyncIoProvider& io, GitLabDaemonImpl& daemon, const Config& config) {
+	kj::HttpHeaderTable::Builder builder;
+	auto tokenHeader = builder.add("X-Gitlab-Token");
+	auto headerTable = builder.build();
+	auto service = kj::heap<SystemHookService>(daemon, *headerTable, tokenHeader, config.systemhooks.secret);
+	auto server = kj::heap<kj::HttpServer>(io.getTimer(), *headerTable, *service);
+	auto& serverRef = *server;
+	return io.getNetwork()
+			.parseAddress(kj::StringPtr{config.systemhooks.listen.c_str()})
+			.then([&serverRef](kj::Own<kj::NetworkAddress> addr) {
+				auto receiver = addr->listen();
+				auto& receiverRef = *receiver;
+				return serverRef.listenHttp(receiverRef).attach(kj::mv(receiver));
+			})
+			.attach(kj::mv(server), kj::mv(service), kj::mv(headerTable));
+}
+
+/**
+ * @brief The ID or name that a request looks up.
+ */
+template <typename Params>
+static std::string requestKey(Params params) {
+	if constexpr (requires { params.getName(); })
+		return params.getName().cStr();
+	else
+		return std::to_string(params.getId());
+}
+
+/**
+ * @brief The capability handed to a single client of the daemon's socket. It knows the credentials of the peer and
+ * passes each request through the scheduler before the shared GitLabDaemonImpl serves it.
+ */
+class ClientSession final : public GitLabDaemon::Server {
+private:
+	using Method = recording::Method;
+
+	GitLabDaemonImpl& impl;
+	Scheduler& scheduler;
+	const SlowLog& slowLog;
+	recording::Writer& recorder;
+	ucred peer;
+
+	template <typename Context>
+	kj::Promise<void>
+	schedule(Context context, kj::Promise<void> (GitLabDaemonImpl::*handler)(Context), Method method) {
+		auto requestId = context.getParams().getRequestId();
+		auto admission = scheduler.admit(peer);
+		if (!admission) {
+			spdlog::warn(
+					"Rejecting request {:016x} of uid {} (pid {}): too many requests", requestId, peer.uid, peer.pid
+			);
+			context.getResults().setErrcode(static_cast<uint32_t>(Error::Overloaded));
+			return kj::READY_NOW;
+		}
+		auto queued = Trace::Clock::now();
+		auto trace = kj::heap<Trace>(requestId, recording::methodName(method), peer.uid, peer.pid);
+		auto& traceRef = *trace;
+		auto key = recorder.isOpen() ? requestKey(context.getParams()) : std::string{};
+		auto found = kj::heap<bool>(false);
+		auto& foundRef = *found;
+		// However the request ends: failed and cancelled requests (e.g., the client gave up waiting) are just as slow
+		auto submit = kj::defer([this, method, trace = kj::mv(trace), key = kj::mv(key), found = kj::mv(found)] {
+			trace->finish();
+			slowLog.submit(*trace);
+			recorder.write(recording::Record{
+					.time = std::chrono::duration_cast<std::chrono::microseconds>(
+							std::chrono::system_clock::now().time_since_epoch()
+					),
+					.method = method,
+					.hit = !trace->contains("upstream"),
+					.found = *found,
+					.key = key
+			});
+		});
+		return admission->turn
+				.then([this, context, handler, &trace = traceRef, &found = foundRef, queued]() mutable {
+					trace.record("queue", "", queued, Trace::Clock::now());
+					kj::Promise<void> handled = nullptr;
+					{
+						Trace::Scope scope(&trace);
+						GitLabDaemonImpl::CallerScope caller(impl, peer);
+						handled = (impl.*handler)(context);
+					}
+					return handled.then(
+							[context, &trace, &found]() mutable {
+								trace.setOutcome("served");
+								found = context.getResults().getErrcode() == static_cast<uint32_t>(Error::Ok);
+							},
+							[&trace](kj::Exception&& e) {
+								trace.setOutcome(e.getDescription().cStr());
+								kj::throwFatalException(kj::mv(e));
+							}
+					);
+				})
+				.attach(kj::mv(admission->slot), kj::mv(submit));
+	}
+
+public:
+	ClientSession(
+			GitLabDaemonImpl& impl, Scheduler& scheduler, const SlowLog& slowLog, recording::Writer& recorder,
+			const ucred& peer
+	)
+			: impl(impl), scheduler(scheduler), slowLog(slowLog), recorder(recorder), peer(peer) {}
+
+	virtual ::kj::Promise<void> getUserByID(GetUserByIDContext context) override {
+		return schedule(context, &GitLabDaemonImpl::getUserByID, Method::GetUserByID);
+	}
+	virtual ::kj::Promise<void> getUserByName(GetUserByNameContext context) override {
+		return schedule(context, &GitLabDaemonImpl::getUserByName, Method::GetUserByName);
+	}
+	virtual ::kj::Promise<void> getSSHKeys(GetSSHKeysContext context) override {
+		return schedule(context, &GitLabDaemonImpl::getSSHKeys, Method::GetSSHKeys);
+	}
+	virtual ::kj::Promise<void> getGroupByID(GetGroupByIDContext context) override {
+		return schedule(context, &GitLabDaemonImpl::getGroupByID, Method::GetGroupByID);
+	}
+	virtual ::kj::Promise<void> getGroupByName(GetGroupByNameContext context) override {
+		return schedule(context, &GitLabDaemonImpl::getGroupByName, Method::GetGroupByName);
+	}
+	virtual ::kj::Promise<void> getPasswdByID(GetPasswdByIDContext context) override {
+		return schedule(context, &GitLabDaemonImpl::getPasswdByID, Method::GetPasswdByID);
+	}
+	virtual ::kj::Promise<void> getPasswdByName(GetPasswdByNameContext context) override {
+		return schedule(context, &GitLabDaemonImpl::getPasswdByName, Method::GetPasswdByName);
+	}
+	virtual ::kj::Promise<void> getGroupRecordByID(GetGroupRecordByIDContext context) override {
+		return schedule(context, &GitLabDaemonImpl::getGroupRecordByID, Method::GetGroupRecordByID);
+	}
+	virtual ::kj::Promise<void> getGroupRecordByName(GetGroupRecordByNameContext context) override {
+		return schedule(context, &GitLabDaemonImpl::getGroupRecordByName, Method::GetGroupRecordByName);
+	}
+	virtual ::kj::Promise<void> getGroupIDsByName(GetGroupIDsByNameContext context) override {
+		return schedule(context, &GitLabDaemonImpl::getGroupIDsByName, Method::GetGroupIDsByName);
+	}
+};
+
+/**
+ * @brief A connection to the daemon's socket; destroyed once the client disconnects.
+ */
+struct Connection {
+	kj::Own<kj::AsyncIoStream> stream;
+	capnp::TwoPartyVatNetwork network;
+	capnp::RpcSystem<capnp::rpc::twoparty::VatId> rpcSystem;
+
+	Connection(kj::Own<kj::AsyncIoStream>&& stream, capnp::Capability::Client bootstrap)
+			: stream(kj::mv(stream)), network(*this->stream, capnp::rpc::twoparty::Side::SERVER),
+			  rpcSystem(capnp::makeRpcServer(network, kj::mv(bootstrap))) {}
+};
+
+class ConnectionErrorHandler final : public kj::TaskSet::ErrorHandler {
+public:
+	void taskFailed(kj::Exception&& exception) override {
+		spdlog::warn("Connection failed: {}", exception.getDescription().cStr());
+	}
+};
+
+static kj::Promise<void> acceptLoop(
+		kj::ConnectionReceiver& listener, GitLabDaemonImpl& impl, Scheduler& scheduler, const SlowLog& slowLog,
+		recording::Writer& recorder, kj::TaskSet& connections
+) {
+	return listener.accept().then([&](kj::Own<kj::AsyncIoStream>&& stream) {
+		ucred peer{.pid = 0, .uid = static_cast<uid_t>(-1), .gid = static_cast<gid_t>(-1)};
+		uint length = sizeof(peer);
+		try {
+			stream->getsockopt(SOL_SOCKET, SO_PEERCRED, &peer, &length);
+		} catch (kj::Exception& e) {
+			spdlog::warn("Failed to identify peer: {}", e.getDescription().cStr());
+		}
+		spdlog::debug("Accepted connection from uid {} (pid {})", peer.uid, peer.pid);
+		auto connection = kj::heap<Connection>(
+				kj::mv(stream), kj::heap<ClientSession>(impl, scheduler, slowLog, recorder, peer)
+		);
+		auto disconnected = connection->network.onDisconnect();
+		connections.add(disconnected.attach(kj::mv(connection)));
+		return acceptLoop(listener, impl, scheduler, slowLog, recorder, connections);
+	});
+}
+
+static kj::Promise<void> logStatsPeriodically(
+		kj::Timer& timer, const GitLabDaemonImpl& daemon, const Scheduler& scheduler, kj::Duration interval
+) {
+	return timer.afterDelay(interval).then([&timer, &daemon, &scheduler, interval] {
+		daemon.logStats();
+		spdlog::info("scheduler: {} requests rejected", scheduler.numRejected());
+		return logStatsPeriodically(timer, daemon, scheduler, interval);
+	});
+}
+
+/**
+ * @brief Flushes the recording every few seconds, such that a crash loses at most the last few seconds of it and a
+ * recording that is still being written can be replayed.
+ */
+static kj::Promise<void> flushPeriodically(kj::Timer& timer, recording::Writer& recorder) {
+	return timer.afterDelay(5 * kj::SECONDS).then([&timer, &recorder] {
+		recorder.flush();
+		return flushPeriodically(timer, recorder);
+	});
+}
+
+/**
+ * @brief Hands the users that CacheWarmer fetched on its thread to the caches until it is done.
+ */
+static kj::Promise<void> warmUpPeriodically(kj::Timer& timer, GitLabDaemonImpl& daemon) {
+	return timer.afterDelay(1 * kj::SECONDS).then([&timer, &daemon]() -> kj::Promise<void> {
+		if (!daemon.warmUp())
+			return kj::READY_NOW;
+		return warmUpPeriodically(timer, daemon);
+	});
+}
+
 static auto [promise, fulfiller] = kj::newPromiseAndFulfiller<void>();
 int main(int argc, char* argv[]) {
 	bool daemonize = true;
@@ -270,14 +1501,88 @@ int main(int argc, char* argv[]) {
 	auto config = Config::fromFile(configPath);
 	auto socketPath = config.general.socketPath;
 	spdlog::info("Success! Will use {} to communicate with GitLab", config.gitlabapi.baseUrl);
+	if (config.client.timeout <= config.gitlabapi.timeout)
+		spdlog::warn(
+				"client.timeout ({} ms) is not larger than gitlabapi.timeout ({} ms); clients will give up on lookups "
+				"that the daemon would still answer",
+				config.client.timeout, config.gitlabapi.timeout
+		);
+	spdlog::info("Publishing client settings to {}", ClientConfig::Path);
+	ClientConfig clientConfig{
+			.uidOffset = config.nss.uidOffset,
+			.gidOffset = config.nss.gidOffset,
+			.timeout = std::chrono::milliseconds{config.client.timeout},
+			.breakerThreshold = config.client.breakerThreshold,
+			.breakerCooldown = std::chrono::seconds{config.client.breakerCooldown}
+	};
+	if (!clientConfig.write())
+		spdlog::error(
+				"Failed to write {} with errno {}; the NSS module will not resolve anything", ClientConfig::Path, errno
+		);
+	if (!config.filter.enabled) {
+		// Don't leave the filter of a previous run behind; it would reject accounts created since
+		unlink(AccountFilter::Path);
+	}
+	// Declared before the daemon and the connections, which write to it until they are destroyed
+	recording::Writer recorder;
+	if (!config.general.recordFile.empty()) {
+		spdlog::info("Recording requests to {}", config.general.recordFile.string());
+		if (!recorder.open(config.general.recordFile))
+			spdlog::error(
+					"Failed to open {} (or it is a recording of another version); I will not record requests",
+					config.general.recordFile.string()
+			);
+	}
 	spdlog::info("Binding socket to {}", socketPath.string());
-	capnp::Capability::Client heap{kj::heap<GitLabDaemonImpl>(config)};
+	GitLabDaemonImpl daemonImpl{config, recorder};
+	Scheduler scheduler{config.limits};
+	auto io = kj::setupAsyncIo();
+	auto& waitScope = io.waitScope;
 	auto addr = std::format("unix:{}", socketPath.string());
-	kj::StringPtr bind = addr.c_str();
-	capnp::EzRpcServer server{heap, bind};
-	auto& waitScope = server.getWaitScope();
+	auto listener = io.provider->getNetwork().parseAddress(kj::StringPtr{addr.c_str()}).wait(waitScope)->listen();
+	// Declared before the connections since destroying them cancels their requests, which still submit their traces
+	SlowLog slowLog{config};
+	ConnectionErrorHandler errorHandler;
+	kj::TaskSet connections{errorHandler};
+	auto accepting = acceptLoop(*listener, daemonImpl, scheduler, slowLog, recorder, connections)
+							 .eagerlyEvaluate([](kj::Exception&& e) {
+								 spdlog::error("Failed to accept connections: {}", e.getDescription().cStr());
+							 });
+
+	kj::Promise<void> stats = kj::READY_NOW;
+	if (config.general.statsInterval > 0)
+		stats = logStatsPeriodically(
+						io.provider->getTimer(), daemonImpl, scheduler, config.general.statsInterval * kj::SECONDS
+		)
+						.eagerlyEvaluate([](kj::Exception&& e) {
+							spdlog::error("Logging statistics failed: {}", e.getDescription().cStr());
+						});
+
+	kj::Promise<void> flushing = kj::READY_NOW;
+	if (recorder.isOpen())
+		flushing = flushPeriodically(io.provider->getTimer(), recorder).eagerlyEvaluate([](kj::Exception&& e) {
+			spdlog::error("Flushing the recording failed: {}", e.getDescription().cStr());
+		});
+
+	kj::Promise<void> warming = kj::READY_NOW;
+	if (!config.warmup.groups.empty())
+		warming = warmUpPeriodically(io.provider->getTimer(), daemonImpl).eagerlyEvaluate([](kj::Exception&& e) {
+			spdlog::error("Warming up the caches failed: {}", e.getDescription().cStr());
+		});
+
+	kj::Promise<void> systemHooks = kj::READY_NOW;
+	if (config.systemhooks.listen.empty()) {
+		spdlog::info("No system hook listener configured");
+	} else if (config.systemhooks.secret.empty()) {
+		spdlog::error("A system hook listener is configured but no secret could be read; I will not listen");
+	} else {
+		spdlog::info("Listening for system hooks on {}", config.systemhooks.listen);
+		systemHooks = listenSystemHooks(*io.provider, daemonImpl, config)
+							  .eagerlyEvaluate([](kj::Exception&& e) {
+								  spdlog::error("The system hook listener failed: {}", e.getDescription().cStr());
+							  });
+	}
 
-	waitScope.poll(); /* Poll once to create the socket file. */
 	spdlog::info("Setting socket permissions for {} to 0o{:o}", socketPath.c_str(), config.general.socketPerms);
 	if (chmod(socketPath.c_str(), static_cast<mode_t>(config.general.socketPerms)) != 0)
 		spdlog::warn("Failed to change permissions with errno {}", errno);
@@ -290,7 +1595,7 @@ int main(int argc, char* argv[]) {
 	spdlog::info("Listening...");
 	promise.wait(waitScope);
 
-	// A shame that EzRpcServer does not clean up after itself :(
+	// The listener does not clean up after itself
 	unlink(socketPath.string().c_str());
 	spdlog::info("Good bye!");
 	return 0;
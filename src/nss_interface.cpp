@@ -1,8 +1,8 @@
-#include <config.hpp>
+#include <accountfilter.hpp>
+#include <clientconfig.hpp>
 #include <error.hpp>
 #include <rpcclient.hpp>
 
-#include <spdlog/sinks/rotating_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
@@ -10,141 +10,239 @@
 #include <nss.h>
 #include <pwd.h>
 #include <shadow.h>
-#include <sys/stat.h>
 
-#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <span>
-#include <spanstream>
 
-namespace fs = std::filesystem;
-
-static auto initLogger() {
+/**
+ * Nothing in here may run on library load: the module is loaded by virtually every process on the host (ls, ps, cron,
+ * ...), most of which never look up a GitLab account. Hence, the logger and the configuration are only created once
+ * they are first needed.
+ */
 
+static std::shared_ptr<spdlog::logger>& getLogger() {
+	static auto logger = [] {
 #if DEBUG
-	auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+		auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
 #endif
-	// auto filesink = std::make_shared<spdlog::sinks::basic_file_sink_mt>("/var/log/gitlabnss-client.log");
-	// auto filesink = std::make_shared<spdlog::sinks::rotating_file_sink_mt>("/var/log/gitlabnss-client.log", 5 * 1024 * 1024, 3);
-	std::vector<spdlog::sink_ptr> sinks{
+		std::vector<spdlog::sink_ptr> sinks{
 #if DEBUG
-			console_sink,
+				console_sink,
 #endif
-			// filesink
-	};
-	auto logger = std::make_shared<spdlog::logger>("", sinks.begin(), sinks.end());
-	logger->set_level(spdlog::level::trace);
-	logger->flush_on(spdlog::level::info);
-	SPDLOG_LOGGER_DEBUG(logger, "Logger created");
+		};
+		auto logger = std::make_shared<spdlog::logger>("", sinks.begin(), sinks.end());
+		logger->set_level(spdlog::level::trace);
+		logger->flush_on(spdlog::level::info);
+		SPDLOG_LOGGER_DEBUG(logger, "Logger created");
+		return logger;
+	}();
 	return logger;
 }
 
-static auto logger = initLogger();
-static auto config = Config::fromFile(fs::current_path().root_path() / "etc" / "gitlabnss" / "gitlabnss.conf");
+/**
+ * @brief Returns the settings published by the daemon or nullptr if the daemon has not published them (yet). New
+ * settings (e.g., since the daemon restarted with other offsets) are picked up within a second.
+ */
+static std::shared_ptr<const ClientConfig> getConfig() {
+	static PublishedFile<ClientConfig> config;
+	return config.get();
+}
 
-static auto getGroupId(const Group::Reader& group) {
-	if (group.getLocal())
-		return group.getId();
-	return group.getId() + config.nss.gidOffset;
+/**
+ * @brief Returns the account filter published by the daemon or nullptr if there is none. A new generation of the
+ * filter is picked up within a second.
+ */
+static std::shared_ptr<const AccountFilter> getFilter() {
+	static PublishedFile<AccountFilter> filter;
+	return filter.get([](const AccountFilter& loaded) {
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Loaded generation {} of the account filter", loaded.generation);
+	});
 }
 
-void populatePasswd(passwd& pwd, const User::Reader& user, std::span<char> buffer) {
-	auto stream = std::ospanstream(buffer);
-	// Username
-	pwd.pw_name = buffer.data() + stream.tellp();
-	stream << user.getUsername().cStr() << '\0';
-	// Password
-	const char Password[] = "*"; // user can't login with PW: https://www.man7.org/linux/man-pages/man5/shadow.5.html
-	pwd.pw_passwd = buffer.data() + stream.tellp();
-	stream << Password << '\0';
-	// UID
-	pwd.pw_uid = user.getId() + config.nss.uidOffset;
-	// GID
-	pwd.pw_gid = user.getGroups().size() > 0 ? getGroupId(user.getGroups()[0]) : 65534 /*nogroup*/;
-	// Real Name
-	pwd.pw_gecos = buffer.data() + stream.tellp();
-	stream << user.getName().cStr() << '\0';
-	// Shell
-	pwd.pw_shell = buffer.data() + stream.tellp();
-	stream << config.nss.shell << '\0';
-	// Home directory
-	pwd.pw_dir = buffer.data() + stream.tellp();
-	std::string homedir = config.nss.homesRoot / user.getUsername().cStr();
-	if (config.nss.createHomedirs && !fs::exists(config.nss.homesRoot / user.getUsername().cStr())) {
-		try {
-			fs::create_directories(config.nss.homesRoot / user.getUsername().cStr());
-			chown(homedir.c_str(), pwd.pw_uid, pwd.pw_gid);
-			chmod(homedir.c_str(), config.nss.homePerms);
-		} catch (fs::filesystem_error& e) {
-			/** Ignore permission denied **/
-		}
+/**
+ * @brief Checks if the published filter rules out that the ID or name belongs to a GitLab account. If so, the lookup
+ * can be answered without asking the daemon.
+ */
+template <typename T>
+static bool isCertainlyUnknown(AccountFilter::Kind kind, T key) {
+	auto filter = getFilter();
+	if (filter && !filter->mayContain(kind, key)) {
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Not a GitLab account according to the filter");
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Remembers failed calls to the daemon within this process. Once breakerThreshold consecutive calls failed or
+ * timed out, lookups fail right away for breakerCooldown instead of each waiting for the timeout again. The first call
+ * after the cooldown probes whether the daemon recovered.
+ */
+class CircuitBreaker final {
+private:
+	std::mutex mutex;
+	unsigned failures = 0;
+	std::chrono::steady_clock::time_point openUntil;
+
+public:
+	bool isOpen(const ClientConfig& config) {
+		std::lock_guard lock(mutex);
+		return config.breakerThreshold > 0 && failures >= config.breakerThreshold &&
+			   std::chrono::steady_clock::now() < openUntil;
+	}
+	void succeeded() {
+		std::lock_guard lock(mutex);
+		failures = 0;
+	}
+	void failed(const ClientConfig& config) {
+		std::lock_guard lock(mutex);
+		if (++failures >= config.breakerThreshold)
+			openUntil = std::chrono::steady_clock::now() + config.breakerCooldown;
+	}
+};
+
+static CircuitBreaker& getBreaker() {
+	static CircuitBreaker breaker;
+	return breaker;
+}
+
+/**
+ * @brief Connects to the daemon unless the circuit breaker is open.
+ */
+static std::shared_ptr<GitLabDaemon::Client> connectToDaemon(kj::AsyncIoContext& io, const ClientConfig& config) {
+	if (getBreaker().isOpen(config)) {
+		SPDLOG_LOGGER_DEBUG(getLogger(), "The daemon failed repeatedly; not trying again yet");
+		return nullptr;
+	}
+	auto daemon = initClient(io, config.timeout);
+	if (!daemon)
+		getBreaker().failed(config);
+	return daemon;
+}
+
+/**
+ * @brief Sends the request with a new request ID and waits for the daemon's response, but no longer than the
+ * configured timeout.
+ * @returns std::nullopt if the daemon did not respond in time or the connection failed.
+ */
+template <typename Params, typename Results>
+static std::optional<capnp::Response<Results>>
+callDaemon(kj::AsyncIoContext& io, const ClientConfig& config, capnp::Request<Params, Results>& request) {
+	auto requestId = newRequestId();
+	request.setRequestId(requestId);
+	SPDLOG_LOGGER_DEBUG(getLogger(), "Sending request {:016x}", requestId);
+	auto response = waitWithDeadline(io, request.send(), config.timeout);
+	if (response) {
+		getBreaker().succeeded();
+	} else {
+		SPDLOG_LOGGER_ERROR(
+				getLogger(), "The daemon did not respond to request {:016x} within {} ms", requestId,
+				config.timeout.count()
+		);
+		getBreaker().failed(config);
+	}
+	return response;
+}
+
+/**
+ * @brief Copies the pre-rendered record into the caller's buffer and points the passwd fields into it.
+ */
+static nss_status fillPasswd(passwd& pwd, const PasswdRecord::Reader& record, std::span<char> buffer, int* errnop) {
+	auto data = record.getData();
+	if (data.size() > buffer.size()) {
+		*errnop = ERANGE;
+		return nss_status::NSS_STATUS_TRYAGAIN;
 	}
-	stream << homedir << '\0';
+	std::memcpy(buffer.data(), data.begin(), data.size());
+	pwd.pw_name = buffer.data() + record.getName();
+	pwd.pw_passwd = buffer.data() + record.getPasswd();
+	pwd.pw_uid = record.getUid();
+	pwd.pw_gid = record.getGid();
+	pwd.pw_gecos = buffer.data() + record.getGecos();
+	pwd.pw_dir = buffer.data() + record.getDir();
+	pwd.pw_shell = buffer.data() + record.getShell();
+	return nss_status::NSS_STATUS_SUCCESS;
 }
 
 extern "C" {
 nss_status _nss_gitlab_getpwuid_r(uid_t uid, passwd* pwd, char* buf, size_t buflen, int* errnop) {
-	SPDLOG_LOGGER_DEBUG(logger, "getpwuid_r({})", uid);
-	if (uid < config.nss.uidOffset)
+	SPDLOG_LOGGER_DEBUG(getLogger(), "getpwuid_r({})", uid);
+	auto config = getConfig();
+	if (!config)
+		return NSS_STATUS_UNAVAIL;
+	if (uid < config->uidOffset || isCertainlyUnknown(AccountFilter::Kind::UserID, uid - config->uidOffset))
 		return nss_status::NSS_STATUS_NOTFOUND;
-	SPDLOG_LOGGER_DEBUG(logger, "Fetching User {}", uid - config.nss.uidOffset);
+	SPDLOG_LOGGER_DEBUG(getLogger(), "Fetching User {}", uid - config->uidOffset);
 	auto io = kj::setupAsyncIo();
-	auto& waitScope = io.waitScope;
-	auto daemon = initClient(io);
+	auto daemon = connectToDaemon(io, *config);
 
 	if (!daemon)
 		return NSS_STATUS_UNAVAIL;
 
-	auto request = daemon->getUserByIDRequest();
-	request.setId(uid - config.nss.uidOffset);
-	auto promise = request.send().wait(waitScope);
+	auto request = daemon->getPasswdByIDRequest();
+	request.setId(uid - config->uidOffset);
+	auto response = callDaemon(io, *config, request);
+	if (!response)
+		return NSS_STATUS_UNAVAIL;
+	auto& promise = *response;
 
-	auto user = promise.getUser();
-	auto err = static_cast<Error>(promise.getErrcode());
-	if (err == Error::Ok && std::string("active") == user.getState().cStr()) {
-		populatePasswd(*pwd, user, {buf, buflen});
-		SPDLOG_LOGGER_DEBUG(logger, "Found!");
-		return nss_status::NSS_STATUS_SUCCESS;
-	} else if (err == Error::Ok) {
-		SPDLOG_LOGGER_DEBUG(logger, "User is not active (status: {})", user.getState().cStr());
-		return nss_status::NSS_STATUS_NOTFOUND;
-	} else if (err == Error::NotFound) {
-		SPDLOG_LOGGER_DEBUG(logger, "Not Found");
+	switch (static_cast<Error>(promise.getErrcode())) {
+	case Error::Ok:
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Found!");
+		return fillPasswd(*pwd, promise.getRecord(), {buf, buflen}, errnop);
+	case Error::NotFound:
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Not Found");
 		return nss_status::NSS_STATUS_NOTFOUND;
-	} else {
-		SPDLOG_LOGGER_ERROR(logger, "Other Error");
-		SPDLOG_LOGGER_ERROR(logger, "Error {}", promise.getErrcode());
+	case Error::Overloaded:
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Daemon is overloaded");
+		*errnop = EAGAIN;
+		return nss_status::NSS_STATUS_TRYAGAIN;
+	default:
+		SPDLOG_LOGGER_ERROR(getLogger(), "Other Error");
+		SPDLOG_LOGGER_ERROR(getLogger(), "Error {}", promise.getErrcode());
 		return nss_status::NSS_STATUS_UNAVAIL;
 	}
 }
 
 nss_status _nss_gitlab_getpwnam_r(const char* name, passwd* pwd, char* buf, size_t buflen, int* errnop) {
-	SPDLOG_LOGGER_DEBUG(logger, "getpwnam_r({})", name);
+	SPDLOG_LOGGER_DEBUG(getLogger(), "getpwnam_r({})", name);
+	if (isCertainlyUnknown(AccountFilter::Kind::UserName, std::string_view{name}))
+		return nss_status::NSS_STATUS_NOTFOUND;
+	auto config = getConfig();
+	if (!config)
+		return NSS_STATUS_UNAVAIL;
 	auto io = kj::setupAsyncIo();
-	auto& waitScope = io.waitScope;
-	auto daemon = initClient(io);
+	auto daemon = connectToDaemon(io, *config);
 
 	if (!daemon)
 		return NSS_STATUS_UNAVAIL;
 
-	auto request = daemon->getUserByNameRequest();
+	auto request = daemon->getPasswdByNameRequest();
 	request.setName(name);
-	auto promise = request.send().wait(waitScope);
+	auto response = callDaemon(io, *config, request);
+	if (!response)
+		return NSS_STATUS_UNAVAIL;
+	auto& promise = *response;
 
-	auto user = promise.getUser();
-	auto err = static_cast<Error>(promise.getErrcode());
-	if (err == Error::Ok && std::string("active") == user.getState().cStr()) {
-		populatePasswd(*pwd, user, {buf, buflen});
-		SPDLOG_LOGGER_DEBUG(logger, "Found!");
-		return nss_status::NSS_STATUS_SUCCESS;
-	} else if (err == Error::Ok) {
-		SPDLOG_LOGGER_DEBUG(logger, "User is not active (status: {})", user.getState().cStr());
-		return nss_status::NSS_STATUS_NOTFOUND;
-	} else if (err == Error::NotFound) {
-		SPDLOG_LOGGER_DEBUG(logger, "Not Found");
+	switch (static_cast<Error>(promise.getErrcode())) {
+	case Error::Ok:
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Found!");
+		return fillPasswd(*pwd, promise.getRecord(), {buf, buflen}, errnop);
+	case Error::NotFound:
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Not Found");
 		return nss_status::NSS_STATUS_NOTFOUND;
-	} else {
-		SPDLOG_LOGGER_ERROR(logger, "Other Error");
-		SPDLOG_LOGGER_ERROR(logger, "Error {}", promise.getErrcode());
+	case Error::Overloaded:
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Daemon is overloaded");
+		*errnop = EAGAIN;
+		return nss_status::NSS_STATUS_TRYAGAIN;
+	default:
+		SPDLOG_LOGGER_ERROR(getLogger(), "Other Error");
+		SPDLOG_LOGGER_ERROR(getLogger(), "Error {}", promise.getErrcode());
 		return nss_status::NSS_STATUS_UNAVAIL;
 	}
 }
@@ -152,83 +250,99 @@ nss_status _nss_gitlab_getpwnam_r(const char* name, passwd* pwd, char* buf, size
 /**********************************************************************************************************************/
 /* GROUPS                                                                                                             */
 /**********************************************************************************************************************/
-void populateGroup(group& group, const Group::Reader& obj, std::span<char> buffer) {
-	auto stream = std::ospanstream(buffer);
-	// Username
-	group.gr_name = buffer.data() + stream.tellp();
-	stream << (obj.getLocal() ? "" : config.nss.groupPrefix) << obj.getName().cStr() << '\0';
-	// Password
-	const char Password[] = "*"; // user can't login with PW: https://www.man7.org/linux/man-pages/man5/shadow.5.html
-	group.gr_passwd = buffer.data() + stream.tellp();
-	stream << Password << '\0';
-	// GID
-	group.gr_gid = getGroupId(obj);
-	// Members
-	group.gr_mem = nullptr;
+/**
+ * @brief Copies the pre-rendered record into the caller's buffer and points the group fields into it. The (empty)
+ * member list is placed right behind the strings.
+ */
+static nss_status fillGroup(group& grp, const GroupRecord::Reader& record, std::span<char> buffer, int* errnop) {
+	auto data = record.getData();
+	auto base = reinterpret_cast<uintptr_t>(buffer.data());
+	auto memOffset = ((base + data.size() + alignof(char*) - 1) & ~(alignof(char*) - 1)) - base;
+	if (memOffset + sizeof(char*) > buffer.size()) {
+		*errnop = ERANGE;
+		return nss_status::NSS_STATUS_TRYAGAIN;
+	}
+	std::memcpy(buffer.data(), data.begin(), data.size());
+	grp.gr_name = buffer.data() + record.getName();
+	grp.gr_passwd = buffer.data() + record.getPasswd();
+	grp.gr_gid = record.getGid();
+	grp.gr_mem = reinterpret_cast<char**>(buffer.data() + memOffset);
+	grp.gr_mem[0] = nullptr;
+	return nss_status::NSS_STATUS_SUCCESS;
 }
 
-nss_status _nss_gitlab_getgrgid_r(gid_t gid, group* result_buf, char* buf, size_t buflen, group** result) {
-	SPDLOG_LOGGER_DEBUG(logger, "getgrgid_r({})", gid);
-	if (gid < config.nss.gidOffset)
+nss_status _nss_gitlab_getgrgid_r(gid_t gid, group* result_buf, char* buf, size_t buflen, int* errnop) {
+	SPDLOG_LOGGER_DEBUG(getLogger(), "getgrgid_r({})", gid);
+	auto config = getConfig();
+	if (!config)
+		return NSS_STATUS_UNAVAIL;
+	if (gid < config->gidOffset || isCertainlyUnknown(AccountFilter::Kind::GroupID, gid - config->gidOffset))
 		return nss_status::NSS_STATUS_NOTFOUND;
 	auto io = kj::setupAsyncIo();
-	auto& waitScope = io.waitScope;
-	auto daemon = initClient(io);
+	auto daemon = connectToDaemon(io, *config);
 
 	if (!daemon)
 		return NSS_STATUS_UNAVAIL;
 
-	auto request = daemon->getGroupByIDRequest();
-	request.setId(gid - config.nss.gidOffset);
-	auto promise = request.send().wait(waitScope);
+	auto request = daemon->getGroupRecordByIDRequest();
+	request.setId(gid - config->gidOffset);
+	auto response = callDaemon(io, *config, request);
+	if (!response)
+		return NSS_STATUS_UNAVAIL;
+	auto& promise = *response;
 
-	auto user = promise.getGroup();
 	switch (static_cast<Error>(promise.getErrcode())) {
 	case Error::Ok:
-		populateGroup(*result_buf, user, {buf, buflen});
-		SPDLOG_LOGGER_DEBUG(logger, "Found!");
-		*result = result_buf;
-		return nss_status::NSS_STATUS_SUCCESS;
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Found!");
+		return fillGroup(*result_buf, promise.getRecord(), {buf, buflen}, errnop);
 	case Error::NotFound:
-		SPDLOG_LOGGER_DEBUG(logger, "Not Found");
-		*result = nullptr;
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Not Found");
 		return nss_status::NSS_STATUS_NOTFOUND;
+	case Error::Overloaded:
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Daemon is overloaded");
+		*errnop = EAGAIN;
+		return nss_status::NSS_STATUS_TRYAGAIN;
 	default:
-		SPDLOG_LOGGER_ERROR(logger, "Other Error");
-		SPDLOG_LOGGER_ERROR(logger, "Error {}", promise.getErrcode());
-		*result = nullptr;
+		SPDLOG_LOGGER_ERROR(getLogger(), "Other Error");
+		SPDLOG_LOGGER_ERROR(getLogger(), "Error {}", promise.getErrcode());
 		return nss_status::NSS_STATUS_UNAVAIL;
 	}
 }
 
-nss_status _nss_gitlab_getgrnam_r(const char* name, group* result_buf, char* buf, size_t buflen, group** result) {
-	SPDLOG_LOGGER_DEBUG(logger, "getgrnam_r({})", name);
+nss_status _nss_gitlab_getgrnam_r(const char* name, group* result_buf, char* buf, size_t buflen, int* errnop) {
+	SPDLOG_LOGGER_DEBUG(getLogger(), "getgrnam_r({})", name);
+	if (isCertainlyUnknown(AccountFilter::Kind::GroupName, std::string_view{name}))
+		return nss_status::NSS_STATUS_NOTFOUND;
+	auto config = getConfig();
+	if (!config)
+		return NSS_STATUS_UNAVAIL;
 	auto io = kj::setupAsyncIo();
-	auto& waitScope = io.waitScope;
-	auto daemon = initClient(io);
+	auto daemon = connectToDaemon(io, *config);
 
 	if (!daemon)
 		return NSS_STATUS_UNAVAIL;
 
-	auto request = daemon->getGroupByNameRequest();
+	auto request = daemon->getGroupRecordByNameRequest();
 	request.setName(name);
-	auto promise = request.send().wait(waitScope);
+	auto response = callDaemon(io, *config, request);
+	if (!response)
+		return NSS_STATUS_UNAVAIL;
+	auto& promise = *response;
 
-	auto user = promise.getGroup();
 	switch (static_cast<Error>(promise.getErrcode())) {
 	case Error::Ok:
-		populateGroup(*result_buf, user, {buf, buflen});
-		SPDLOG_LOGGER_DEBUG(logger, "Found!");
-		*result = result_buf;
-		return nss_status::NSS_STATUS_SUCCESS;
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Found!");
+		return fillGroup(*result_buf, promise.getRecord(), {buf, buflen}, errnop);
 	case Error::NotFound:
-		SPDLOG_LOGGER_DEBUG(logger, "Not Found");
-		*result = nullptr;
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Not Found");
 		return nss_status::NSS_STATUS_NOTFOUND;
+	case Error::Overloaded:
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Daemon is overloaded");
+		*errnop = EAGAIN;
+		return nss_status::NSS_STATUS_TRYAGAIN;
 	default:
-		SPDLOG_LOGGER_ERROR(logger, "Other Error");
-		SPDLOG_LOGGER_ERROR(logger, "Error {}", promise.getErrcode());
-		*result = nullptr;
+		SPDLOG_LOGGER_ERROR(getLogger(), "Other Error");
+		SPDLOG_LOGGER_ERROR(getLogger(), "Error {}", promise.getErrcode());
 		return nss_status::NSS_STATUS_UNAVAIL;
 	}
 }
@@ -241,48 +355,63 @@ nss_status _nss_gitlab_initgroups_dyn(
 ) {
 	// Its not well documented how this should behave but we can have a look at sssd for reference:
 	// https://github.com/SSSD/sssd/blob/0c0afb24706ec343563833ea0c654b298dcdcf59/src/sss_client/nss_group.c#L375-L404
-	SPDLOG_LOGGER_DEBUG(logger, "initgroups_dyn({}, {}, {}, {}, {})", username, group, (intptr_t)start, *size, limit);
+	SPDLOG_LOGGER_DEBUG(
+			getLogger(), "initgroups_dyn({}, {}, {}, {}, {})", username, group, (intptr_t)start, *size, limit
+	);
+	if (isCertainlyUnknown(AccountFilter::Kind::UserName, std::string_view{username}))
+		return nss_status::NSS_STATUS_NOTFOUND;
+	auto config = getConfig();
+	if (!config)
+		return NSS_STATUS_UNAVAIL;
 	auto io = kj::setupAsyncIo();
-	auto& waitScope = io.waitScope;
-	auto daemon = initClient(io);
+	auto daemon = connectToDaemon(io, *config);
 
 	if (!daemon)
 		return NSS_STATUS_UNAVAIL;
 
-	auto request = daemon->getUserByNameRequest();
+	auto request = daemon->getGroupIDsByNameRequest();
 	request.setName(username);
-	auto promise = request.send().wait(waitScope);
-
-	auto user = promise.getUser();
-	auto err = static_cast<Error>(promise.getErrcode());
-	if (err == Error::Ok && std::string("active") == user.getState().cStr()) {
-		if (limit < 0 || limit > user.getGroups().size())
-			limit = user.getGroups().size();
-		// Check if groups is large enough, otherwise extend it
-		if (*start + limit > *size) {
-			*groups = static_cast<gid_t*>(std::realloc(*groups, (*start + limit) * sizeof(gid_t)));
-			if (*groups == nullptr) {
-				*errnop = ENOMEM;
-				return NSS_STATUS_TRYAGAIN;
+	auto response = callDaemon(io, *config, request);
+	if (!response)
+		return NSS_STATUS_UNAVAIL;
+	auto& promise = *response;
+
+	switch (static_cast<Error>(promise.getErrcode())) {
+	case Error::Ok: {
+		auto gids = promise.getGids();
+		for (auto gid : gids) {
+			if (gid == group)
+				continue; // The caller already added the user's primary group
+			if (limit > 0 && *start >= limit)
+				break;
+			// Check if groups is large enough, otherwise grow it geometrically
+			if (*start == *size) {
+				auto newSize = std::max<long int>(*size * 2, *start + gids.size());
+				if (limit > 0)
+					newSize = std::min(newSize, limit);
+				auto newGroups = static_cast<gid_t*>(std::realloc(*groups, newSize * sizeof(gid_t)));
+				if (newGroups == nullptr) {
+					*errnop = ENOMEM;
+					return NSS_STATUS_TRYAGAIN;
+				}
+				*groups = newGroups;
+				*size = newSize;
 			}
-			*size = *start + limit;
-		}
-		// Populate groups
-		for (size_t i = 0; i < limit; ++i) {
-			(*groups)[*start] = getGroupId(user.getGroups()[i]);
-			*start += 1;
+			(*groups)[(*start)++] = gid;
 		}
-		SPDLOG_LOGGER_DEBUG(logger, "Found!");
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Found!");
 		return nss_status::NSS_STATUS_SUCCESS;
-	} else if (err == Error::Ok) {
-		SPDLOG_LOGGER_DEBUG(logger, "User is not active (status: {})", user.getState().cStr());
-		return nss_status::NSS_STATUS_NOTFOUND;
-	} else if (err == Error::NotFound) {
-		SPDLOG_LOGGER_DEBUG(logger, "Not Found");
+	}
+	case Error::NotFound:
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Not Found");
 		return nss_status::NSS_STATUS_NOTFOUND;
-	} else {
-		SPDLOG_LOGGER_ERROR(logger, "Other Error");
-		SPDLOG_LOGGER_ERROR(logger, "Error {}", promise.getErrcode());
+	case Error::Overloaded:
+		SPDLOG_LOGGER_DEBUG(getLogger(), "Daemon is overloaded");
+		*errnop = EAGAIN;
+		return nss_status::NSS_STATUS_TRYAGAIN;
+	default:
+		SPDLOG_LOGGER_ERROR(getLogger(), "Other Error");
+		SPDLOG_LOGGER_ERROR(getLogger(), "Error {}", promise.getErrcode());
 		return nss_status::NSS_STATUS_UNAVAIL;
 	}
 }
@@ -0,0 +1,454 @@
+/**
+ * @file
+ * @brief gitlabnss-replay replays a recording of the requests that gitlabnssd served (see record_file in
+ * gitlabnss.conf) against the daemon's caches with different sizes and policies. GitLab is simulated: every request to
+ * it takes the same latency. For every setting, it reports the share of requests answered from the cache, the number of
+ * requests to GitLab and the time requests waited for GitLab.
+ *
+ * Usage: gitlabnss-replay <recording> [--sizes 500:200,...] [--aging 10,...] [--ttl 3600] [--keys-ttl 0] [--prefetch 1]
+ *        [--latency 50]
+ *
+ * --sizes lists the number of entries of the user and group caches (user_cachesize:group_cachesize) to try. --aging
+ * lists the values of cache_aging to try with admission enabled. The other options correspond to cache_ttl, keys_ttl
+ * (in seconds), prefetch (0 or 1) and the latency of GitLab (in milliseconds).
+ *
+ * The caches are modeled by their number of entries only (not by their memory budgets). From what the daemon recorded
+ * about the accounts it fetched, the replay caches an account under its ID and its name, caches the groups of a user
+ * along with them and serves prefetched keys, as the daemon does. Recordings of older daemons lack this; for them, the
+ * hit ratios are a lower bound, but the settings compare fairly. Users cached by the warm-up are not modeled.
+ */
+#include <cache.hpp>
+#include <recording.hpp>
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using recording::Method;
+using recording::Record;
+
+/**
+ * @brief A clock that is set to the time of the replayed request, such that entries expire as they did in the daemon.
+ */
+struct SimulatedClock {
+	using duration = std::chrono::steady_clock::duration;
+	using rep = duration::rep;
+	using period = duration::period;
+	using time_point = std::chrono::time_point<SimulatedClock>;
+	static constexpr bool is_steady = true;
+
+	static inline time_point current{};
+	static time_point now() noexcept { return current; }
+};
+
+struct Setting {
+	size_t userEntries;
+	size_t groupEntries;
+	bool admission;
+	unsigned aging;
+	std::chrono::seconds ttl;
+	std::chrono::seconds keysTTL;
+	bool prefetch;
+};
+
+struct Result {
+	size_t requests = 0;
+	size_t hits = 0;
+	size_t upstreamRequests = 0;
+	size_t upstreamRoundTrips = 0; /**< Requests to GitLab that are in flight at the same time count once. **/
+};
+
+/**
+ * @brief Mirrors how the daemon's handlers look a request up in its caches (see gitlabnssd.cpp).
+ */
+class SimulatedDaemon final {
+private:
+	/** The cached values do not matter, only which keys are cached **/
+	using Cache = LookupCache<std::string, bool, SimulatedClock>;
+
+	/** The requests to GitLab that a cachemiss costs (see gitlab::GitLab) **/
+	struct Cost {
+		unsigned requests;
+		unsigned roundTrips;
+	};
+	static constexpr Cost UserByID{.requests = 2, .roundTrips = 1}; /**< The user and their memberships at once. **/
+	static constexpr Cost UserByName{.requests = 2, .roundTrips = 2}; /**< The ID must be looked up first. **/
+	/** With prefetch, the keys are requested alongside the memberships resp. the user and their memberships. **/
+	static constexpr Cost UserByNameWithKeys{.requests = 3, .roundTrips = 2};
+	static constexpr Cost KeysWithUser{.requests = 3, .roundTrips = 1};
+	static constexpr Cost Group{.requests = 1, .roundTrips = 1};
+	static constexpr Cost Keys{.requests = 1, .roundTrips = 1};
+	/** See PrefetchedKeysLifetime in gitlabnssd.cpp **/
+	static constexpr std::chrono::seconds PrefetchedKeysLifetime{10};
+
+	/** What the daemon learned from GitLab about a user (see recording::LearnedFlag) **/
+	struct KnownUser {
+		std::string username;
+		std::vector<std::pair<std::string, std::string>> groups; /**< IDs and names. **/
+	};
+
+	Setting setting;
+	Cache usercache, groupcache, passwdcache, grentcache, gidcache, keycache;
+	std::unordered_map<std::string, KnownUser> users;
+	std::unordered_map<std::string, std::string> userIDs; /**< By username. **/
+	std::unordered_map<std::string, std::string> groupNames;
+	std::unordered_map<std::string, std::string> groupIDs; /**< By name. **/
+	std::unordered_map<std::string, SimulatedClock::time_point> prefetchedKeys; /**< By user ID. **/
+	Result result;
+	bool hit;
+
+	static CacheOptions options(size_t entries, std::chrono::seconds ttl, const Setting& setting) {
+		return CacheOptions{
+				.maxEntries = entries, .ttl = ttl, .admission = setting.admission, .agingFactor = setting.aging
+		};
+	}
+	template <typename Map>
+	static const std::string* lookupKnown(const Map& map, const std::string& key) {
+		auto it = map.find(key);
+		return it == map.end() ? nullptr : &it->second;
+	}
+
+	void learn(const Record& record) {
+		auto fields = recording::splitFields(record.key);
+		if (record.method == Method::GetUserByID && fields.size() >= 2) {
+			std::string id{fields[0]};
+			auto& user = users[id];
+			user.username = fields[1];
+			user.groups.clear();
+			for (size_t i = 2; i + 1 < fields.size(); i += 2)
+				user.groups.emplace_back(fields[i], fields[i + 1]);
+			userIDs[user.username] = id;
+			for (const auto& [groupID, name] : user.groups)
+				learnGroup(groupID, name);
+		} else if (record.method == Method::GetGroupByID && fields.size() == 2) {
+			learnGroup(std::string{fields[0]}, std::string{fields[1]});
+		}
+	}
+	void learnGroup(const std::string& id, const std::string& name) {
+		groupNames[id] = name;
+		groupIDs[name] = id;
+	}
+
+	void fetch(Cost cost) {
+		result.upstreamRequests += cost.requests;
+		result.upstreamRoundTrips += cost.roundTrips;
+		hit = false;
+	}
+	/**
+	 * @brief Looks the key up in the cache. On a cachemiss, the value is resolved and cached unless the daemon answered
+	 * with an error (errors are not cached). Like the daemon, the value is also cached under its alias if the other key
+	 * of the account is known (e.g., a user's name when looking them up by ID).
+	 */
+	template <typename F>
+	void
+	lookup(Cache& cache, const std::string& cacheId, const std::optional<std::string>& alias, bool found, F&& resolve) {
+		if (cache.find(cacheId) != nullptr)
+			return;
+		resolve();
+		if (!found)
+			return;
+		if (alias)
+			cache.insert_or_assign(cacheId, *alias, true);
+		else
+			cache.insert_or_assign(cacheId, true);
+	}
+
+	/** Caches the user and their groups as GitLabDaemonImpl::cacheUser does **/
+	void cacheUser(const std::string& id, const KnownUser& user) {
+		usercache.insert_or_assign("getUserByID(" + id + ")", "getUserByName(" + user.username + ")", true);
+		for (const auto& [groupID, name] : user.groups)
+			if (!groupcache.contains("getGroupByID(" + groupID + ")"))
+				groupcache.insert_or_assign("getGroupByID(" + groupID + ")", "getGroupByName(" + name + ")", true);
+	}
+	void stashKeys(const std::string& id) {
+		if (setting.keysTTL.count() > 0)
+			keycache.insert_or_assign("getSSHKeys(" + id + ")", true);
+		else
+			prefetchedKeys.insert_or_assign(id, SimulatedClock::now());
+	}
+	bool takePrefetchedKeys(const std::string& id) {
+		auto it = prefetchedKeys.find(id);
+		if (it == prefetchedKeys.end())
+			return false;
+		bool fresh = SimulatedClock::now() - it->second < PrefetchedKeysLifetime;
+		prefetchedKeys.erase(it);
+		return fresh;
+	}
+
+	void userByID(const std::string& id, bool found) {
+		auto cacheId = "getUserByID(" + id + ")";
+		if (usercache.find(cacheId) != nullptr)
+			return;
+		fetch(UserByID);
+		if (!found)
+			return;
+		if (auto it = users.find(id); it != users.end())
+			cacheUser(id, it->second);
+		else
+			usercache.insert_or_assign(cacheId, true);
+	}
+	void userByName(const std::string& name, bool found) {
+		auto cacheId = "getUserByName(" + name + ")";
+		if (usercache.find(cacheId) != nullptr)
+			return;
+		fetch(setting.prefetch ? UserByNameWithKeys : UserByName);
+		if (!found)
+			return;
+		auto id = lookupKnown(userIDs, name);
+		if (id == nullptr) {
+			usercache.insert_or_assign(cacheId, true);
+			return;
+		}
+		cacheUser(*id, users.at(*id));
+		if (setting.prefetch)
+			stashKeys(*id);
+	}
+	void keys(const std::string& id, bool found) {
+		if (setting.keysTTL.count() > 0 && keycache.find("getSSHKeys(" + id + ")") != nullptr)
+			return;
+		if (takePrefetchedKeys(id))
+			return;
+		if (!setting.prefetch || usercache.contains("getUserByID(" + id + ")")) {
+			fetch(Keys);
+		} else {
+			fetch(KeysWithUser);
+			if (auto it = users.find(id); it != users.end())
+				cacheUser(id, it->second);
+		}
+		if (found && setting.keysTTL.count() > 0)
+			keycache.insert_or_assign("getSSHKeys(" + id + ")", true);
+	}
+	void groupByID(const std::string& id, bool found) {
+		auto alias = aliasOf("getGroupByName", lookupKnown(groupNames, id));
+		lookup(groupcache, "getGroupByID(" + id + ")", alias, found, [this] { fetch(Group); });
+	}
+	void groupByName(const std::string& name, bool found) {
+		auto alias = aliasOf("getGroupByID", lookupKnown(groupIDs, name));
+		lookup(groupcache, "getGroupByName(" + name + ")", alias, found, [this] { fetch(Group); });
+	}
+	/** The key of the other lookup of the same account, if the account is known **/
+	static std::optional<std::string> aliasOf(const char* method, const std::string* other) {
+		return other ? std::optional{std::string{method} + "(" + *other + ")"} : std::nullopt;
+	}
+
+public:
+	explicit SimulatedDaemon(const Setting& setting)
+			: setting(setting), usercache(options(setting.userEntries, setting.ttl, setting)),
+			  groupcache(options(setting.groupEntries, setting.ttl, setting)),
+			  passwdcache(options(setting.userEntries, setting.ttl, setting)),
+			  grentcache(options(setting.groupEntries, setting.ttl, setting)),
+			  gidcache(options(setting.userEntries, setting.ttl, setting)),
+			  keycache(options(setting.userEntries, setting.keysTTL, setting)) {}
+
+	void replay(const Record& record) {
+		SimulatedClock::current = SimulatedClock::time_point{
+				std::chrono::duration_cast<SimulatedClock::duration>(record.time)
+		};
+		if (record.learned) {
+			learn(record);
+			return;
+		}
+		hit = true;
+		const auto& key = record.key;
+		bool found = record.found;
+		switch (record.method) {
+		case Method::GetUserByID:
+			userByID(key, found);
+			break;
+		case Method::GetUserByName:
+			userByName(key, found);
+			break;
+		case Method::GetSSHKeys:
+			keys(key, found);
+			break;
+		case Method::GetGroupByID:
+			groupByID(key, found);
+			break;
+		case Method::GetGroupByName:
+			groupByName(key, found);
+			break;
+		case Method::GetPasswdByID: {
+			auto user = users.find(key);
+			auto alias = aliasOf("getPasswdByName", user != users.end() ? &user->second.username : nullptr);
+			lookup(passwdcache, "getPasswdByID(" + key + ")", alias, found, [&] { userByID(key, found); });
+			break;
+		}
+		case Method::GetPasswdByName: {
+			auto alias = aliasOf("getPasswdByID", lookupKnown(userIDs, key));
+			lookup(passwdcache, "getPasswdByName(" + key + ")", alias, found, [&] { userByName(key, found); });
+			break;
+		}
+		case Method::GetGroupRecordByID: {
+			auto alias = aliasOf("getGroupRecordByName", lookupKnown(groupNames, key));
+			lookup(grentcache, "getGroupRecordByID(" + key + ")", alias, found, [&] { groupByID(key, found); });
+			break;
+		}
+		case Method::GetGroupRecordByName: {
+			auto alias = aliasOf("getGroupRecordByID", lookupKnown(groupIDs, key));
+			lookup(grentcache, "getGroupRecordByName(" + key + ")", alias, found, [&] { groupByName(key, found); });
+			break;
+		}
+		case Method::GetGroupIDsByName:
+			lookup(gidcache, "getGroupIDsByName(" + key + ")", std::nullopt, found, [&] { userByName(key, found); });
+			break;
+		default:
+			return; // Recorded by a newer daemon
+		}
+		++result.requests;
+		if (hit)
+			++result.hits;
+	}
+
+	const Result& getResult() const noexcept { return result; }
+};
+
+static std::vector<std::string> split(std::string_view list, char separator) {
+	std::vector<std::string> ret;
+	while (!list.empty()) {
+		auto end = list.find(separator);
+		ret.emplace_back(list.substr(0, end));
+		list.remove_prefix(end == std::string_view::npos ? list.size() : end + 1);
+	}
+	return ret;
+}
+
+/**
+ * @brief Parses a whole number that is at least min; std::nullopt if the text is anything else.
+ */
+static std::optional<unsigned long> parseNumber(const std::string& text, unsigned long min) {
+	if (text.empty() || !std::isdigit(static_cast<unsigned char>(text.front())))
+		return std::nullopt;
+	char* end;
+	errno = 0;
+	auto ret = std::strtoul(text.c_str(), &end, 10);
+	if (*end != '\0' || errno != 0 || ret < min || ret > std::numeric_limits<unsigned>::max())
+		return std::nullopt;
+	return ret;
+}
+
+static void usage() {
+	std::fprintf(
+			stderr, "Usage: gitlabnss-replay <recording> [--sizes 500:200,...] [--aging 10,...] [--ttl 3600] "
+					"[--keys-ttl 0] [--prefetch 1] [--latency 50]\n"
+	);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2 || argc % 2 != 0) {
+		usage();
+		return -1;
+	}
+	std::vector<std::pair<size_t, size_t>> sizes{{100, 40}, {500, 200}, {2000, 800}};
+	std::vector<unsigned> agings{10};
+	std::chrono::seconds ttl{3600};
+	std::chrono::seconds keysTTL{0};
+	bool prefetch = true;
+	double latencyMs = 50;
+	for (int i = 2; i + 1 < argc; i += 2) {
+		std::string_view option{argv[i]};
+		std::string value{argv[i + 1]};
+		bool valid = true;
+		if (option == "--sizes") {
+			sizes.clear();
+			for (const auto& size : split(value, ',')) {
+				auto entries = split(size, ':');
+				auto users = entries.empty() ? std::nullopt : parseNumber(entries[0], 1);
+				auto groups = entries.size() == 2 ? parseNumber(entries[1], 1) : users;
+				valid = valid && users && groups && entries.size() <= 2;
+				if (valid)
+					sizes.emplace_back(*users, *groups);
+			}
+			valid = valid && !sizes.empty();
+		} else if (option == "--aging") {
+			agings.clear();
+			for (const auto& aging : split(value, ',')) {
+				auto parsed = parseNumber(aging, 1);
+				valid = valid && parsed;
+				if (valid)
+					agings.push_back(*parsed);
+			}
+			valid = valid && !agings.empty();
+		} else if (option == "--ttl" || option == "--keys-ttl") {
+			// As in gitlabnss.conf, a cache_ttl of 0 never expires entries and a keys_ttl of 0 disables the key cache
+			auto parsed = parseNumber(value, 0);
+			valid = parsed.has_value();
+			if (valid)
+				(option == "--ttl" ? ttl : keysTTL) = std::chrono::seconds{*parsed};
+		} else if (option == "--prefetch") {
+			valid = value == "0" || value == "1";
+			prefetch = value == "1";
+		} else if (option == "--latency") {
+			char* end;
+			latencyMs = std::strtod(value.c_str(), &end);
+			valid = !value.empty() && *end == '\0' && std::isfinite(latencyMs) && latencyMs >= 0;
+		} else {
+			valid = false;
+		}
+		if (!valid) {
+			usage();
+			return -1;
+		}
+	}
+
+	recording::Reader reader{argv[1]};
+	if (!reader.isOpen()) {
+		std::fprintf(stderr, "%s is not a recording of gitlabnssd\n", argv[1]);
+		return -1;
+	}
+	std::vector<Record> records;
+	size_t requests = 0;
+	size_t recordedHits = 0;
+	while (auto record = reader.next()) {
+		if (!record->learned) {
+			++requests;
+			recordedHits += record->hit;
+		}
+		records.push_back(std::move(*record));
+	}
+	if (requests == 0) {
+		std::fprintf(stderr, "%s contains no requests\n", argv[1]);
+		return -1;
+	}
+	auto span = std::chrono::duration_cast<std::chrono::seconds>(records.back().time - records.front().time);
+	std::printf("%zu requests over %lld s\n", requests, static_cast<long long>(span.count()));
+	std::printf("recorded hit ratio: %.3f\n", static_cast<double>(recordedHits) / requests);
+	if (!reader.hasLearned())
+		std::printf("recorded by an older daemon: accounts are cached by the looked up key only\n");
+	std::printf("\n");
+
+	std::printf(
+			"%-8s %7s %7s %6s %9s %9s %12s %12s\n", "policy", "users", "groups", "aging", "hit ratio", "upstream",
+			"mean (ms)", "total (s)"
+	);
+	for (const auto& [users, groups] : sizes) {
+		std::vector<Setting> settings{{users, groups, false, 0, ttl, keysTTL, prefetch}};
+		for (auto aging : agings)
+			settings.push_back(Setting{users, groups, true, aging, ttl, keysTTL, prefetch});
+		for (const auto& setting : settings) {
+			SimulatedDaemon daemon{setting};
+			for (const auto& record : records)
+				daemon.replay(record);
+			const auto& result = daemon.getResult();
+			if (result.requests == 0)
+				continue; // Only requests of methods unknown to this version of the tool
+			double waitedMs = result.upstreamRoundTrips * latencyMs;
+			std::printf(
+					"%-8s %7zu %7zu %6s %9.3f %9zu %12.2f %12.1f\n", setting.admission ? "tinylfu" : "lru", users,
+					groups, setting.admission ? std::to_string(setting.aging).c_str() : "-",
+					static_cast<double>(result.hits) / result.requests, result.upstreamRequests,
+					waitedMs / result.requests, waitedMs / 1000
+			);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,110 @@
+#include <scheduler.hpp>
+
+#include <algorithm>
+
+Scheduler::Scheduler(const Config::Limits& limits) noexcept : limits(limits) {}
+
+Scheduler::Client& Scheduler::getClient(uid_t uid) {
+	auto now = Clock::now();
+	if (clients.size() > 1024) {
+		// Forget about users that are idle and whose rate limit would be fully replenished anyway. A user whose queue
+		// still holds cancelled requests is not idle: roundRobin refers to them until the requests were dispatched.
+		std::erase_if(clients, [this, now](const auto& entry) {
+			const auto& [uid, client] = entry;
+			std::chrono::duration<double> idle = now - client.refilled;
+			return client.pending == 0 && client.queue.empty() &&
+				   client.tokens + idle.count() * limits.perUIDRate >= limits.perUIDBurst;
+		});
+	}
+	auto [it, inserted] = clients.try_emplace(uid);
+	auto& client = it->second;
+	if (inserted) {
+		client.tokens = limits.perUIDBurst;
+	} else {
+		std::chrono::duration<double> elapsed = now - client.refilled;
+		client.tokens = std::min<double>(limits.perUIDBurst, client.tokens + elapsed.count() * limits.perUIDRate);
+	}
+	client.refilled = now;
+	return client;
+}
+
+std::optional<Scheduler::Admission> Scheduler::admit(const ucred& peer) {
+	auto& client = getClient(peer.uid);
+	auto& pendingOfPID = pendingPerPID[peer.pid];
+	bool privileged = isPrivileged(peer);
+	bool limited = pendingOfPID >= limits.perPIDRequests ||
+				   (!privileged &&
+					(client.pending >= limits.perUIDRequests || (limits.perUIDRate > 0 && client.tokens < 1)));
+	if (limited) {
+		++rejected;
+		if (pendingOfPID == 0)
+			pendingPerPID.erase(peer.pid);
+		return std::nullopt;
+	}
+	// Without a rate limit, the tokens are never refilled and must not be used up either
+	if (!privileged && limits.perUIDRate > 0)
+		client.tokens -= 1;
+	++client.pending;
+	++pendingOfPID;
+
+	auto paf = kj::newPromiseAndFulfiller<void>();
+	auto slot = nextSlot++;
+	Waiting waiting{.fulfiller = kj::mv(paf.fulfiller), .slot = slot};
+	if (privileged) {
+		auto& queue = rootQueues[peer.pid];
+		if (queue.empty())
+			rootRoundRobin.push_back(peer.pid);
+		queue.push_back(kj::mv(waiting));
+	} else {
+		if (client.queue.empty())
+			roundRobin.push_back(peer.uid);
+		client.queue.push_back(kj::mv(waiting));
+	}
+	auto admission = Admission{.turn = kj::mv(paf.promise), .slot = kj::heap<Slot>(*this, peer, slot)};
+	dispatch();
+	return admission;
+}
+
+void Scheduler::dispatch() {
+	while (running == 0) {
+		Waiting next{};
+		if (!rootRoundRobin.empty()) {
+			auto pid = rootRoundRobin.front();
+			rootRoundRobin.pop_front();
+			auto it = rootQueues.find(pid);
+			next = kj::mv(it->second.front());
+			it->second.pop_front();
+			if (it->second.empty())
+				rootQueues.erase(it);
+			else
+				rootRoundRobin.push_back(pid);
+		} else if (!roundRobin.empty()) {
+			auto uid = roundRobin.front();
+			roundRobin.pop_front();
+			auto& queue = clients[uid].queue;
+			next = kj::mv(queue.front());
+			queue.pop_front();
+			if (!queue.empty())
+				roundRobin.push_back(uid);
+		} else {
+			return;
+		}
+		// The request may have been cancelled while it was queued (e.g., the client disconnected)
+		if (next.fulfiller->isWaiting()) {
+			running = next.slot;
+			next.fulfiller->fulfill();
+		}
+	}
+}
+
+void Scheduler::release(const ucred& peer, uint64_t slot) {
+	if (auto it = clients.find(peer.uid); it != clients.end())
+		--it->second.pending;
+	if (auto it = pendingPerPID.find(peer.pid); it != pendingPerPID.end() && --it->second == 0)
+		pendingPerPID.erase(it);
+	// Whether or not the request started; it may have been cancelled right after it was dispatched
+	if (slot == running) {
+		running = 0;
+		dispatch();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include <trace.hpp>
+
+#include <spdlog/sinks/rotating_file_sink.h>
+#include <spdlog/spdlog.h>
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include <algorithm>
+#include <format>
+
+thread_local Trace* Trace::currentTrace = nullptr;
+
+Trace::Trace(uint64_t requestId, std::string method, uid_t uid, pid_t pid)
+		: requestId(requestId), method(std::move(method)), uid(uid), pid(pid), start(Clock::now()), end(start) {}
+
+void Trace::record(std::string name, std::string detail, Clock::time_point begin, Clock::time_point end) {
+	std::lock_guard lock(mutex);
+	spans.emplace_back(Span{
+			.name = std::move(name), .detail = std::move(detail), .begin = begin - start, .duration = end - begin
+	});
+}
+
+bool Trace::contains(std::string_view name) const {
+	std::lock_guard lock(mutex);
+	return std::any_of(spans.begin(), spans.end(), [name](const Span& span) { return span.name == name; });
+}
+
+static double toMillis(Trace::Clock::duration duration) {
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+std::string Trace::toJSON() const {
+	std::lock_guard lock(mutex);
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	writer.StartObject();
+	writer.Key("requestId");
+	// As a string since JSON numbers can't represent all 64 bit integers
+	writer.String(std::format("{:016x}", requestId).c_str());
+	writer.Key("method");
+	writer.String(method.c_str());
+	writer.Key("uid");
+	writer.Uint(uid);
+	writer.Key("pid");
+	writer.Int(pid);
+	writer.Key("outcome");
+	writer.String(outcome.c_str());
+	writer.Key("totalMs");
+	writer.Double(toMillis(duration()));
+	writer.Key("spans");
+	writer.StartArray();
+	for (const auto& span : spans) {
+		writer.StartObject();
+		writer.Key("name");
+		writer.String(span.name.c_str());
+		if (!span.detail.empty()) {
+			writer.Key("detail");
+			writer.String(span.detail.c_str());
+		}
+		writer.Key("beginMs");
+		writer.Double(toMillis(span.begin));
+		writer.Key("durationMs");
+		writer.Double(toMillis(span.duration));
+		writer.EndObject();
+	}
+	writer.EndArray();
+	writer.EndObject();
+	return buffer.GetString();
+}
+
+SlowLog::SlowLog(const Config& config) : threshold(config.general.slowThreshold) {
+	if (threshold.count() == 0)
+		return;
+	auto sink =
+			std::make_shared<spdlog::sinks::rotating_file_sink_mt>(config.general.slowLog.string(), 5 * 1024 * 1024, 3);
+	logger = std::make_shared<spdlog::logger>("slow", sink);
+	logger->set_pattern("{\"time\":\"%Y-%m-%dT%H:%M:%S.%e%z\",\"request\":%v}");
+	logger->flush_on(spdlog::level::info);
+}
+
+void SlowLog::submit(const Trace& trace) const {
+	if (logger && trace.duration() >= threshold)
+		logger->info(trace.toJSON());
+}
\ No newline at end of file